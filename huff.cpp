@@ -1,17 +1,25 @@
 /* huff.cpp - Simple huffman compressor. */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include "huffman/huffman.hpp"
 
 void printHelp();
-void compress(const std::string& src, const std::string& dst);
-void extract(const std::string& src, const std::string& dst);
-std::string readFile(const std::string& path);
-void writeFile(const std::string& path, const std::string& content);
+bool parseOptions(int argc, char* argv[], bool extracting, HuffmanOptions& options, bool& stats);
+bool parseSize(const std::string& arg, std::size_t& size);
+bool parseThreads(const std::string& arg, unsigned& threads);
+void compress(const std::string& src, const std::string& dst, const HuffmanOptions& options, bool stats);
+void extract(const std::string& src, const std::string& dst, const HuffmanOptions& options, bool stats);
+void writeOutput(const std::string& dst, const std::function<void(std::ostream&)>& write);
+void printStats(const HuffmanStats& stats);
 
 int main(int argc, char* argv[]) {
     // Parse arguments.
@@ -22,28 +30,21 @@ int main(int argc, char* argv[]) {
     std::string verb(argv[1]);
     if (verb == "-h" || verb == "--help") {
         printHelp();
-    } else if (verb == "-c" || verb == "--compress") {
-        if (argc != 4) {
+    } else if (verb == "-c" || verb == "--compress" || verb == "-x" || verb == "--extract") {
+        const bool extracting = verb == "-x" || verb == "--extract";
+        HuffmanOptions options;
+        bool stats = false;
+        if (argc < 4 || !parseOptions(argc, argv, extracting, options, stats)) {
             std::cerr << "Missing / invalid arguments" << std::endl;
             return EXIT_FAILURE;
         }
         try {
-            compress(std::string(argv[2]), std::string(argv[3]));
-        } catch (std::runtime_error& e) {
-            std::cerr << e.what() << std::endl;
-            return EXIT_FAILURE;
-        }
-
-        return EXIT_SUCCESS;
-
-    } else if (verb == "-x" || verb == "--extract") {
-        if (argc != 4) {
-            std::cerr << "Missing / invalid arguments" << std::endl;
-            return EXIT_FAILURE;
-        }
-        try {
-            extract(std::string(argv[2]), std::string(argv[3]));
-        } catch (std::runtime_error& e) {
+            if (extracting) {
+                extract(std::string(argv[2]), std::string(argv[3]), options, stats);
+            } else {
+                compress(std::string(argv[2]), std::string(argv[3]), options, stats);
+            }
+        } catch (std::exception& e) {
             std::cerr << e.what() << std::endl;
             return EXIT_FAILURE;
         }
@@ -59,41 +60,133 @@ void printHelp() {
     std::cout << "huff - Simple huffman compressor\n"
               << "Params:\n"
               << "huff --help     | -h\n"
-              << "huff --compress | -c  [source] [target]\n"
-              << "huff --extract  | -x  [source] [target]\n";
+              << "huff --compress | -c  [source] [target] [--max-memory SIZE] [--stats]\n"
+              << "huff --extract  | -x  [source] [target] [--threads | -j N] [--max-memory SIZE] [--stats]\n"
+              << "SIZE is in bytes, with an optional K, M or G suffix.\n";
 }
 
-void compress(const std::string& src, const std::string& dst) {
-    HuffmanEncoder he(readFile(src));
-    he.result().write(dst);
+// Parse options after source and target.
+bool parseOptions(int argc, char* argv[], bool extracting, HuffmanOptions& options, bool& stats) {
+    for (int i = 4; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--max-memory" && i + 1 < argc) {
+            if (!parseSize(argv[++i], options.maxMemory) || options.maxMemory == 0) {
+                return false;
+            }
+        } else if (extracting && (arg == "-j" || arg == "--threads") && i + 1 < argc) {
+            if (!parseThreads(argv[++i], options.threads)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
 }
 
-void extract(const std::string& src, const std::string& dst) {
-    HuffmanFile hf(src);
-    HuffmanDecoder hd(hf);
-    writeFile(dst, hd.result());
+// Parse a positive thread count, clamped to a few per hardware thread.
+bool parseThreads(const std::string& arg, unsigned& threads) {
+    if (arg.empty() || arg.size() > 9 || arg.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    threads = std::stoul(arg);
+    if (threads == 0) {
+        return false;
+    }
+    threads = std::min(threads, 4 * std::max(1u, std::thread::hardware_concurrency()));
+    return true;
 }
 
-std::string readFile(const std::string& path) {
-    std::ifstream ifs(path);
+// Parse a byte count such as 65536, 64K, 64M or 1G.
+bool parseSize(const std::string& arg, std::size_t& size) {
+    // std::stoull would accept leading spaces and signs.
+    if (arg.empty() || arg.find_first_of("0123456789") != 0) {
+        return false;
+    }
+    std::size_t end = 0;
+    try {
+        size = std::stoull(arg, &end);
+    } catch (std::logic_error&) {
+        return false;
+    }
+    const std::string suffix = arg.substr(end);
+    unsigned shift = 0;
+    if (suffix == "K" || suffix == "k") {
+        shift = 10;
+    } else if (suffix == "M" || suffix == "m") {
+        shift = 20;
+    } else if (suffix == "G" || suffix == "g") {
+        shift = 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    if (size > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    size <<= shift;
+    return true;
+}
 
+void compress(const std::string& src, const std::string& dst, const HuffmanOptions& options, bool stats) {
+    std::ifstream ifs(src, std::ios::binary);
     if (!ifs.is_open()) {
-        throw std::runtime_error("Failed to open file: " + path);
+        throw std::runtime_error("Failed to open file: " + src);
     }
 
-    std::ostringstream oss;
-    oss << ifs.rdbuf();
-    ifs.close();
-    return oss.str();
+    writeOutput(dst, [&](std::ostream& ofs) {
+        HuffmanEncoder he(ifs, ofs, options);
+        if (stats) {
+            printStats(he.stats());
+        }
+    });
 }
 
-void writeFile(const std::string& path, const std::string& content) {
-    std::ofstream ofs(path, std::ios::binary);
+void extract(const std::string& src, const std::string& dst, const HuffmanOptions& options, bool stats) {
+    std::ifstream ifs(src, std::ios::binary);
+    if (!ifs.is_open()) {
+        throw std::runtime_error("Failed to open file: " + src);
+    }
 
+    // Output is streamed before the stream checksum is verified.
+    writeOutput(dst, [&](std::ostream& ofs) {
+        HuffmanDecoder hd(ifs, ofs, options);
+        if (stats) {
+            printStats(hd.stats());
+        }
+    });
+}
+
+/**
+ * @brief Run write into a temporary file next to dst, then move it onto dst.
+ * @details On failure the temporary file is removed, so dst is never left
+ * truncated or holding unverified output.
+ */
+void writeOutput(const std::string& dst, const std::function<void(std::ostream&)>& write) {
+    const std::string tmp = dst + ".huff-tmp";
+    std::ofstream ofs(tmp, std::ios::binary);
     if (!ofs.is_open()) {
-        throw std::runtime_error("Failed to open file: " + path);
+        throw std::runtime_error("Failed to open file: " + tmp);
     }
 
-    ofs.write(content.data(), content.size());
-    ofs.close();
-}
\ No newline at end of file
+    try {
+        write(ofs);
+        ofs.close();
+        if (!ofs) {
+            throw std::runtime_error("Failed to write file: " + tmp);
+        }
+        std::filesystem::rename(tmp, dst);
+    } catch (...) {
+        ofs.close();
+        std::remove(tmp.c_str());
+        throw;
+    }
+}
+
+void printStats(const HuffmanStats& stats) {
+    std::cerr << "Peak memory: " << stats.peakMemory << " bytes\n"
+              << "Buffer size: " << stats.bufferSize << " bytes\n"
+              << "Block size:  " << stats.blockSize << " bytes\n"
+              << "Threads:     " << stats.threads << "\n";
+}
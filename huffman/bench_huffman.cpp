@@ -0,0 +1,70 @@
+/* bench_huffman.cpp - Decode throughput of HuffmanDecoder modes. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "huffman.hpp"
+
+// Input with skewed byte frequencies over the given alphabet size.
+std::string makeInput(std::size_t size, int alphabet, double skew) {
+    std::mt19937 rng(42);
+    std::vector<double> weights;
+    for (int i = 0; i < alphabet; ++i) {
+        weights.push_back(1.0 / std::pow(i + 1, skew));
+    }
+    std::discrete_distribution<int> dist(weights.begin(), weights.end());
+
+    std::string content(size, 0);
+    for (char& c : content) {
+        c = static_cast<char>(dist(rng));
+    }
+    return content;
+}
+
+// Best of several runs, in MB/s of decoded output.
+double measure(const HuffmanFile& file, HuffmanDecoder::Mode mode, std::size_t size, unsigned threads = 1) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        HuffmanDecoder hd(file, mode, threads);
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        best = std::max(best, size / seconds / 1e6);
+    }
+    return best;
+}
+
+int main() {
+    struct Case {
+        const char* name;
+        int alphabet;
+        double skew;
+    };
+    const std::size_t size = 16 * 1024 * 1024;
+    const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::string parallel = "x" + std::to_string(threads) + " MB/s";
+
+    std::cout << std::left << std::setw(24) << "input"
+              << std::setw(12) << "tree MB/s"
+              << std::setw(12) << "table MB/s"
+              << std::setw(12) << parallel << '\n';
+
+    for (const Case& c : {Case{"alphabet 16, skewed", 16, 1.0},
+                          Case{"alphabet 64, zipf", 64, 1.0},
+                          Case{"alphabet 256, zipf", 256, 1.2}}) {
+        std::string content = makeInput(size, c.alphabet, c.skew);
+        HuffmanFile file = HuffmanEncoder(content).result();
+
+        std::cout << std::left << std::setw(24) << c.name << std::fixed << std::setprecision(1)
+                  << std::setw(12) << measure(file, HuffmanDecoder::Mode::Tree, size)
+                  << std::setw(12) << measure(file, HuffmanDecoder::Mode::Auto, size)
+                  << std::setw(12) << measure(file, HuffmanDecoder::Mode::Auto, size, threads) << '\n';
+    }
+}
@@ -0,0 +1,128 @@
+/* fuzz_huffman.cpp - libFuzzer target for HuffmanFile / HuffmanDecoder. */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "huffman.hpp"
+
+// Content appended to sync tables so that they may declare large blocks.
+static const std::size_t STRETCH_BYTES = 8 << 20;
+
+static uint32_t loadWord(const std::string& data, std::size_t pos) {
+    uint32_t word = 0;
+    for (int i = 3; i >= 0; --i) {
+        word = word << 8 | static_cast<uint8_t>(data[pos + i]);
+    }
+    return word;
+}
+
+static void storeWord(std::string& data, std::size_t pos, uint32_t word) {
+    for (int i = 0; i < 4; ++i) {
+        data[pos + i] = static_cast<char>(word >> (8 * i));
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    std::string input(reinterpret_cast<const char*>(data), size);
+
+    // Untrusted input must either decode or throw, never crash.
+    std::string expected;
+    bool decoded = false;
+    try {
+        std::istringstream iss(input, std::ios::binary);
+        HuffmanFile hf(iss);
+        HuffmanDecoder hd(hf);
+        // Parallel decoding must agree with serial decoding.
+        if (HuffmanDecoder(hf, HuffmanDecoder::Mode::Auto, 4).result() != hd.result()) {
+            __builtin_trap();
+        }
+        expected = hd.result();
+        decoded = true;
+    } catch (std::runtime_error&) {
+    }
+
+    // Stream decoding must not accept anything else.
+    for (const std::size_t maxMemory : {std::size_t(0), std::size_t(1) << 20}) {
+        for (const unsigned threads : {1u, 4u}) {
+            try {
+                HuffmanOptions options;
+                options.maxMemory = maxMemory;
+                options.threads = threads;
+                std::istringstream iss(input, std::ios::binary);
+                std::ostringstream oss(std::ios::binary);
+                HuffmanDecoder(iss, oss, options);
+                if (!decoded || oss.str() != expected) {
+                    __builtin_trap();
+                }
+            } catch (std::runtime_error&) {
+            }
+        }
+    }
+
+    // Declare the largest blocks the block count allows over padded content, and
+    // decode in parallel without a cap. Buffers sized from the declared block
+    // size rather than the sync table would run past the fuzzer's malloc limit.
+    if (size >= 24 && input.compare(0, 4, "HUF3") == 0 && loadWord(input, 20) >= 2) {
+        std::string stretched = input + std::string(STRETCH_BYTES, '\0');
+        const uint64_t contentBits = std::min<uint64_t>(loadWord(input, 12) + uint64_t(8) * STRETCH_BYTES, UINT32_MAX);
+        storeWord(stretched, 12, contentBits);
+        storeWord(stretched, 16, (contentBits - 1) / (loadWord(input, 20) - 1));
+        try {
+            HuffmanOptions options;
+            options.threads = 4;
+            std::istringstream iss(stretched, std::ios::binary);
+            std::ostringstream oss(std::ios::binary);
+            HuffmanDecoder(iss, oss, options);
+        } catch (std::runtime_error&) {
+        }
+    }
+
+    // Any input with two or more distinct bytes must round trip.
+    try {
+        HuffmanEncoder he(input, 64);
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        he.result().write(ss);
+        HuffmanFile hf(ss);
+        if (HuffmanDecoder(hf).result() != input) {
+            __builtin_trap();
+        }
+
+        // Stream encoding too.
+        HuffmanOptions options;
+        options.blockSize = 64;
+        std::istringstream in(input, std::ios::binary);
+        std::stringstream encoded(std::ios::in | std::ios::out | std::ios::binary);
+        HuffmanEncoder(in, encoded, options);
+        std::ostringstream out(std::ios::binary);
+        HuffmanDecoder(encoded, out, options);
+        if (out.str() != input) {
+            __builtin_trap();
+        }
+    } catch (std::invalid_argument&) {
+    }
+
+    return 0;
+}
+
+#ifdef HUFFMAN_FUZZ_STANDALONE
+// Replay driver for compilers without libFuzzer: run each file given as an argument.
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream ifs(argv[i], std::ios::binary);
+        if (!ifs.is_open()) {
+            std::cerr << "Failed to open file: " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -1,22 +1,150 @@
 #include "huffman.hpp"
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <istream>
+#include <ostream>
 #include <iostream>
 #include <queue>
 #include <ranges>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+/////////////////////
+// HuffmanChecksum //
+/////////////////////
+
+namespace {
+
+// Lookup tables for reflected CRC32C polynomial 0x82F63B78.
+// entries[0] advances one byte. entries[k] advances a byte followed by k zero bytes,
+// which lets update() consume 8 bytes per step (slicing-by-8).
+struct Crc32cTable {
+    uint32_t entries[8][256];
+
+    constexpr Crc32cTable() : entries() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int b = 0; b < 8; ++b) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+            }
+            entries[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                entries[k][i] = entries[0][entries[k - 1][i] & 0xFF] ^ (entries[k - 1][i] >> 8);
+            }
+        }
+    }
+};
+
+constexpr Crc32cTable crc32cTable;
+
+}  // namespace
+
+HuffmanChecksum::HuffmanChecksum() : crc(0xFFFFFFFFu) {}
+
+void HuffmanChecksum::reset() {
+    crc = 0xFFFFFFFFu;
+}
+
+void HuffmanChecksum::update(char c) {
+    crc = crc32cTable.entries[0][(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+}
+
+void HuffmanChecksum::update(const char* data, std::size_t size) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const auto& t = crc32cTable.entries;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const uint32_t lo = crc ^ (uint32_t(p[i]) | uint32_t(p[i + 1]) << 8 | uint32_t(p[i + 2]) << 16 | uint32_t(p[i + 3]) << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][p[i + 4]] ^ t[2][p[i + 5]] ^ t[1][p[i + 6]] ^ t[0][p[i + 7]];
+    }
+    for (; i < size; ++i) {
+        update(data[i]);
+    }
+}
+
+uint32_t HuffmanChecksum::value() const {
+    return crc ^ 0xFFFFFFFFu;
+}
+
+uint32_t HuffmanChecksum::compute(const std::string& data) {
+    HuffmanChecksum checksum;
+    checksum.update(data.data(), data.size());
+    return checksum.value();
+}
+
+///////////////////
+// HuffmanMemory //
+///////////////////
+
+HuffmanMemory::HuffmanMemory(std::size_t limit) : limit(limit) {}
+
+/**
+ * @brief Account for a buffer about to be allocated.
+ * @throws std::runtime_error if it would take the working set over the cap.
+ */
+void HuffmanMemory::acquire(std::size_t bytes) {
+    if (bytes > available()) {
+        throw std::runtime_error("Memory budget exceeded: need " + std::to_string(current + bytes) +
+                                 " bytes, limit " + std::to_string(limit));
+    }
+    current += bytes;
+    peakBytes = std::max(peakBytes, current);
+}
+
+void HuffmanMemory::release(std::size_t bytes) {
+    current -= std::min(bytes, current);
+}
+
+std::size_t HuffmanMemory::available() const {
+    if (limit == 0) {
+        return SIZE_MAX;
+    }
+    return limit > current ? limit - current : 0;
+}
+
+std::size_t HuffmanMemory::peak() const {
+    return peakBytes;
+}
+
+// I/O buffer size for a stream constructor, taking at most 1/share of what is left.
+std::size_t HuffmanMemory::bufferSize(unsigned share) const {
+    // Leave some slack for padding.
+    const std::size_t part = available() / share;
+    return std::max(MIN_BUFFER_SIZE, std::min(DEFAULT_BUFFER_SIZE, part - std::min<std::size_t>(part, 64)));
+}
+
 /////////////////
 // HuffmanTree //
 /////////////////
 
 // Create tree from content string.
 HuffmanTree::HuffmanTree(const std::string& content) {
-    generateTree(content);
+    // Map all characters to their frequencies of appearance.
+    std::unordered_map<char, uint64_t> charFreqMap;
+
+    for (const char c : content) {
+        charFreqMap[c] += 1;
+    }
+
+    generateTree(charFreqMap);
+    encodeTree(treePtr, treeBits, leaves);
+    // Initialize traverse pointer.
+    ptr = treePtr;
+}
+
+// Create tree from character frequencies.
+HuffmanTree::HuffmanTree(const std::unordered_map<char, uint64_t>& charFreqMap) {
+    generateTree(charFreqMap);
     encodeTree(treePtr, treeBits, leaves);
     // Initialize traverse pointer.
     ptr = treePtr;
@@ -26,9 +154,24 @@ HuffmanTree::HuffmanTree(const std::string& content) {
 HuffmanTree::HuffmanTree(const HuffmanFile& file) {
     treeBits = file.treeBits;
     leaves = file.leaves;
+    // Bound recursion depth of decodeTree before trusting the bits.
+    if (leaves.size() < 2 || leaves.size() > HuffmanFile::MAX_LEAVES || treeBits.size() != 2 * leaves.size() - 1) {
+        throw std::runtime_error("Invalid tree: bad tree size");
+    }
+    // Codes are looked up by character, so a character may only have one leaf.
+    bool seen[256] = {};
+    for (const char c : leaves) {
+        if (seen[static_cast<uint8_t>(c)]) {
+            throw std::runtime_error("Invalid tree: duplicate leaf");
+        }
+        seen[static_cast<uint8_t>(c)] = true;
+    }
     std::deque tmpTreeBits(treeBits);
     std::deque tmpLeaves(leaves);
     treePtr = decodeTree(tmpTreeBits, tmpLeaves);
+    if (!tmpTreeBits.empty() || !tmpLeaves.empty() || isLeafNode(treePtr)) {
+        throw std::runtime_error("Invalid tree: malformed tree bits");
+    }
     // Initialize traverse pointer.
     ptr = treePtr;
 }
@@ -40,7 +183,11 @@ void HuffmanTree::reset() {
 }
 
 bool HuffmanTree::isLeaf() const {
-    return ptr->one == nullptr && ptr->zero == nullptr;
+    return isLeafNode(ptr);
+}
+
+bool HuffmanTree::isLeafNode(const std::shared_ptr<TreeNode>& node) {
+    return node->one == nullptr && node->zero == nullptr;
 }
 
 char HuffmanTree::getChar() const {
@@ -73,16 +220,20 @@ bool HuffmanTree::descend(bool direction) {
     return true;
 }
 
+bool HuffmanTree::atRoot() const {
+    return ptr == treePtr;
+}
+
 void HuffmanTree::ascend() {
     ptr = tStack.back();
     tStack.pop_back();
 }
 
-void HuffmanTree::generateTree(const std::string& content) {
+void HuffmanTree::generateTree(const std::unordered_map<char, uint64_t>& charFreqMap) {
     // Package TreeNode with its priority (frequency of appearance).
     struct PriorityTreeNode {
         std::shared_ptr<TreeNode> node;
-        int priority;
+        uint64_t priority;
     };
 
     // Compare struct with () operator for std::priority_queue.
@@ -95,14 +246,6 @@ void HuffmanTree::generateTree(const std::string& content) {
 
     std::priority_queue<PriorityTreeNode, std::vector<PriorityTreeNode>, CompareNodes> treePQ;
 
-    // Map all characters to their frequencies of appearance.
-    std::unordered_map<char, int>
-        charFreqMap;
-
-    for (const char c : content) {
-        charFreqMap[c] += 1;
-    }
-
     // Check whether there are more than only one character.
     if (charFreqMap.size() < 2) {
         throw std::invalid_argument("Sole character input not allowed!");
@@ -121,7 +264,7 @@ void HuffmanTree::generateTree(const std::string& content) {
     while (treePQ.size() != 1) {
         std::shared_ptr<TreeNode> newTree = std::make_shared<TreeNode>();
         PriorityTreeNode temp;
-        int newPriority = 0;
+        uint64_t newPriority = 0;
         // Attach zero sub-tree.
         temp = treePQ.top();
         treePQ.pop();
@@ -160,9 +303,15 @@ void HuffmanTree::encodeTree(const std::shared_ptr<HuffmanTree::TreeNode> treePt
 }
 
 std::shared_ptr<HuffmanTree::TreeNode> HuffmanTree::decodeTree(std::deque<bool>& treeBits, std::deque<char>& leaves) {
+    if (treeBits.empty()) {
+        throw std::runtime_error("Invalid tree: ran out of tree bits");
+    }
     std::shared_ptr<TreeNode> temp = std::make_shared<TreeNode>();
     // Base case: front bit in bits is zero (leaf node).
     if (treeBits.front() == 0) {
+        if (leaves.empty()) {
+            throw std::runtime_error("Invalid tree: ran out of leaves");
+        }
         // Dequeue 0 from bits.
         treeBits.pop_front();
         temp->ch = leaves.front();
@@ -180,6 +329,38 @@ std::shared_ptr<HuffmanTree::TreeNode> HuffmanTree::decodeTree(std::deque<bool>&
     return temp;
 }
 
+// Map each leaf character to its code.
+std::unordered_map<char, std::vector<bool>> HuffmanTree::getCodeMap() {
+    std::unordered_map<char, std::vector<bool>> codeMap;
+    std::vector<bool> code;
+    reset();
+    buildCodeMap(code, codeMap);
+    return codeMap;
+}
+
+void HuffmanTree::buildCodeMap(std::vector<bool>& code, std::unordered_map<char, std::vector<bool>>& codeMap) {
+    // Base case: is leaf.
+    if (isLeaf()) {
+        codeMap.insert({getChar(), code});
+    } else {
+        if (descend(0)) {
+            code.push_back(0);
+            buildCodeMap(code, codeMap);
+            // Backtrack.
+            code.pop_back();
+            ascend();
+        }
+
+        if (descend(1)) {
+            code.push_back(1);
+            buildCodeMap(code, codeMap);
+            // Backtrack.
+            code.pop_back();
+            ascend();
+        }
+    }
+}
+
 std::deque<bool> HuffmanTree::getTreeBits() {
     return treeBits;
 }
@@ -191,83 +372,913 @@ std::deque<char> HuffmanTree::getLeaves() {
 // HuffmanEncoder //
 ////////////////////
 
-HuffmanEncoder::HuffmanEncoder(const std::string& content) : tree(content) {
-    res.content = encodeString(content);
-    res.treeBits = tree.getTreeBits();
-    res.leaves = tree.getLeaves();
+HuffmanEncoder::HuffmanEncoder(const std::string& content, uint32_t blockSize, bool syncPoints) : tree(content) {
+    if (blockSize == 0) {
+        throw std::invalid_argument("Checksum block size must be positive!");
+    }
+    memory.acquire(HuffmanMemory::TREE_BYTES);
+    beginEncode(blockSize, syncPoints);
+    encodeChunk(content.data(), content.size());
+    endEncode();
+
+    statistics.bufferSize = res.content.capacity();
+    memory.acquire(statistics.bufferSize + (res.blockChecksums.capacity() + res.syncOffsets.capacity()) * sizeof(uint32_t));
+    statistics.peakMemory = memory.peak();
+}
+
+/**
+ * @brief Encode a stream within a memory budget.
+ * @details The first pass counts characters to build the tree, the second
+ * encodes through fixed buffers. The header is written with zeroed tables
+ * first and rewritten once the checksums are known.
+ */
+HuffmanEncoder::HuffmanEncoder(std::istream& in, std::ostream& out, const HuffmanOptions& options)
+    : memory(options.maxMemory), charFreqMap(countChars(in, memory)), tree(charFreqMap) {
+    if (options.blockSize == 0) {
+        throw std::invalid_argument("Checksum block size must be positive!");
+    }
+
+    // Tree and code map, roughly.
+    memory.acquire(HuffmanMemory::TREE_BYTES);
+    codeMap = tree.getCodeMap();
+
+    // Sizes are known from the counts.
+    uint64_t inputSize = 0;
+    uint64_t contentSize = 0;
+    std::size_t maxLength = 0;
+    for (const auto& pair : charFreqMap) {
+        const std::size_t length = codeMap[pair.first].size();
+        inputSize += pair.second;
+        contentSize += pair.second * length;
+        maxLength = std::max(maxLength, length);
+    }
+    if (contentSize > UINT32_MAX) {
+        throw std::runtime_error("Input too large: encoded content exceeds " + std::to_string(UINT32_MAX) + " bits");
+    }
+
+    // Keep a decoder's block buffers well within the same budget, but grow
+    // blocks if needed so that the tables, 8 bytes per block, take at most an eighth.
+    uint32_t blockSize = options.blockSize;
+    if (options.maxMemory != 0) {
+        blockSize = std::max<uint64_t>(HuffmanMemory::MIN_BUFFER_SIZE, std::min<uint64_t>(blockSize, options.maxMemory / 16));
+        const uint64_t maxBlocks = std::max<uint64_t>(1, options.maxMemory / 8 / (2 * sizeof(uint32_t)));
+        blockSize = std::max<uint64_t>(blockSize, (inputSize + maxBlocks - 1) / maxBlocks);
+    }
+    const std::size_t blocks = (inputSize + blockSize - 1) / blockSize;
+    memory.acquire(blocks * 2 * sizeof(uint32_t));
+
+    // Header with zeroed tables.
+    beginEncode(blockSize, options.syncPoints);
+    res.contentBits = contentSize;
+    res.blockChecksums.resize(blocks);
+    if (syncPoints) {
+        res.syncOffsets.resize(blocks);
+    }
+    const std::ostream::pos_type headerPos = out.tellp();
+    res.writeHeader(out);
+    res.contentBits = 0;
+    res.blockChecksums.clear();
+    res.syncOffsets.clear();
+
+    // Each step of input encodes into at most bufferSize bytes.
+    const std::size_t bufferSize = memory.bufferSize(2);
+    memory.acquire(2 * bufferSize);
+    std::vector<char> buffer(bufferSize);
+    res.content.reserve(bufferSize);
+    const std::size_t step = std::max<std::size_t>(1, (bufferSize - 1) * 8 / maxLength);
+
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        const std::size_t n = in.gcount();
+        for (std::size_t i = 0; i < n; i += step) {
+            encodeChunk(buffer.data() + i, std::min(step, n - i));
+            flushContent(out, false);
+        }
+    }
+    endEncode();
+    flushContent(out, true);
+
+    if (res.contentBits != contentSize || res.blockChecksums.size() != blocks) {
+        throw std::runtime_error("Input changed while encoding");
+    }
+
+    // Rewrite header with tables filled in.
+    const std::ostream::pos_type endPos = out.tellp();
+    out.seekp(headerPos);
+    res.writeHeader(out);
+    out.seekp(endPos);
+    if (!out) {
+        throw std::runtime_error("Failed to write output");
+    }
+
+    statistics.peakMemory = memory.peak();
+    statistics.bufferSize = bufferSize;
 }
 
 HuffmanFile HuffmanEncoder::result() const {
     return res;
 }
 
-std::deque<bool> HuffmanEncoder::encodeString(const std::string& content) {
-    std::deque<bool> res;
-    std::unordered_map<char, std::vector<bool>> codeMap;
-    std::vector<bool> code;
-    buildCodeMap(code, codeMap);
+HuffmanStats HuffmanEncoder::stats() const {
+    return statistics;
+}
 
-    for (const char c : content) {
-        for (const bool b : codeMap[c]) {
-            res.push_back(b);
+// Count characters of in, then rewind it, reading through a buffer that fits memory.
+std::unordered_map<char, uint64_t> HuffmanEncoder::countChars(std::istream& in, HuffmanMemory& memory) {
+    // Leave room for the tree and tables.
+    const std::size_t bufferSize = memory.bufferSize(2);
+    memory.acquire(bufferSize);
+
+    const std::istream::pos_type start = in.tellg();
+    uint64_t counts[256] = {};
+    std::vector<char> buffer(bufferSize);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        const std::size_t n = in.gcount();
+        for (std::size_t i = 0; i < n; ++i) {
+            ++counts[static_cast<uint8_t>(buffer[i])];
         }
     }
+    in.clear();
+    in.seekg(start);
+    if (!in) {
+        throw std::runtime_error("Failed to rewind input");
+    }
+    memory.release(bufferSize);
 
-    return res;
+    std::unordered_map<char, uint64_t> charFreqMap;
+    for (int c = 0; c < 256; ++c) {
+        if (counts[c] != 0) {
+            charFreqMap[static_cast<char>(c)] = counts[c];
+        }
+    }
+    return charFreqMap;
 }
 
-void HuffmanEncoder::buildCodeMap(std::vector<bool>& code, std::unordered_map<char, std::vector<bool>>& codeMap) {
-    // Base case: is leaf.
-    if (tree.isLeaf()) {
-        codeMap.insert({tree.getChar(), code});
-    } else {
-        if (tree.descend(0)) {
-            code.push_back(0);
-            buildCodeMap(code, codeMap);
-            // Backtrack.
-            code.pop_back();
-            tree.ascend();
+void HuffmanEncoder::beginEncode(uint32_t blockSize, bool syncPoints) {
+    if (codeMap.empty()) {
+        codeMap = tree.getCodeMap();
+    }
+    this->syncPoints = syncPoints;
+    res.treeBits = tree.getTreeBits();
+    res.leaves = tree.getLeaves();
+    res.blockSize = blockSize;
+    statistics.blockSize = blockSize;
+    statistics.threads = 1;
+}
+
+// Encode the next chunk of input, appending to res.
+void HuffmanEncoder::encodeChunk(const char* data, std::size_t size) {
+    // Checksums are computed in the same pass as encoding.
+    for (std::size_t i = 0; i < size; ++i) {
+        const char c = data[i];
+
+        // Record where each block starts.
+        if (syncPoints && inBlock == 0) {
+            res.syncOffsets.push_back(res.contentBits);
         }
 
-        if (tree.descend(1)) {
-            code.push_back(1);
-            buildCodeMap(code, codeMap);
-            // Backtrack.
-            code.pop_back();
-            tree.ascend();
+        // Pack code bits MSB first.
+        for (const bool b : codeMap[c]) {
+            if (res.contentBits % 8 == 0) {
+                res.content.push_back(0);
+            }
+            if (b) {
+                res.content.back() |= (1 << (7 - res.contentBits % 8));
+            }
+            ++res.contentBits;
+        }
+
+        blockCrc.update(c);
+        streamCrc.update(c);
+        if (++inBlock == res.blockSize) {
+            res.blockChecksums.push_back(blockCrc.value());
+            blockCrc.reset();
+            inBlock = 0;
         }
     }
 }
 
+void HuffmanEncoder::endEncode() {
+    // Trailing partial block.
+    if (inBlock != 0) {
+        res.blockChecksums.push_back(blockCrc.value());
+    }
+    res.streamChecksum = streamCrc.value();
+}
+
+// Write complete content bytes to out. A partial last byte is kept until isLast.
+void HuffmanEncoder::flushContent(std::ostream& out, bool isLast) {
+    const std::size_t complete = isLast || res.contentBits % 8 == 0 ? res.content.size() : res.content.size() - 1;
+    out.write(reinterpret_cast<const char*>(res.content.data()), complete);
+    res.content.erase(res.content.begin(), res.content.begin() + complete);
+}
+
 ////////////////////
 // HuffmanDecoder //
 ////////////////////
 
-HuffmanDecoder::HuffmanDecoder(const HuffmanFile& file) : tree(file) {
-    std::deque<bool> tempContent(file.content);
-    decodeString(tempContent);
+HuffmanDecoder::HuffmanDecoder(const HuffmanFile& file, Mode mode, unsigned threads)
+    : tree(file),
+      blockSize(file.blockSize),
+      blockChecksums(file.blockChecksums),
+      streamChecksum(file.streamChecksum),
+      syncOffsets(file.syncOffsets),
+      contentBits(file.contentBits),
+      totalBits(file.contentBits) {
+    memory.acquire(HuffmanMemory::TREE_BYTES + (blockChecksums.size() + syncOffsets.size()) * sizeof(uint32_t));
+
+    // Pad so that the kernels may always load 8 bytes.
+    statistics.bufferSize = file.content.size() + 8;
+    memory.acquire(statistics.bufferSize);
+    packed.reserve(statistics.bufferSize);
+    packed.assign(file.content.begin(), file.content.end());
+    packed.resize(statistics.bufferSize, 0);
+    statistics.blockSize = blockSize;
+    statistics.threads = 1;
+
+    const bool useTable = mode != Mode::Tree && buildTable();
+    memory.acquire(table.size() * sizeof(TableEntry));
+    if (threads <= 1) {
+        if (useTable) {
+            decodeBlocks(&HuffmanDecoder::decodeTable);
+        } else {
+            decodeString();
+        }
+        memory.acquire(res.capacity());
+    } else {
+        const Kernel kernel = useTable ? &HuffmanDecoder::decodeTable : &HuffmanDecoder::walkTree;
+        if (!syncOffsets.empty()) {
+            decodeSynced(kernel, threads);
+            memory.acquire(res.capacity());
+        } else {
+            // Accounts for its output as it goes.
+            decodeSpeculative(kernel, threads);
+        }
+    }
+    statistics.peakMemory = memory.peak();
+}
+
+HuffmanDecoder::HuffmanDecoder(std::istream& in, std::ostream& out, const HuffmanOptions& options)
+    : HuffmanDecoder(HuffmanFile::readHeader(in, options.maxMemory), in, out, options) {}
+
+/**
+ * @brief Decode a stream within a memory budget.
+ * @details Prefers decoding batches of blocks in parallel from their sync
+ * points, with as many threads as both options.threads and the budget
+ * allow. Without sync points, falls back to speculative decoding of the
+ * whole content if there is no cap, and otherwise to a single thread
+ * decoding through a sliding window.
+ */
+HuffmanDecoder::HuffmanDecoder(HuffmanFile header, std::istream& in, std::ostream& out, const HuffmanOptions& options)
+    : tree(header),
+      memory(options.maxMemory),
+      blockSize(header.blockSize),
+      blockChecksums(std::move(header.blockChecksums)),
+      streamChecksum(header.streamChecksum),
+      syncOffsets(std::move(header.syncOffsets)),
+      contentBits(0),
+      totalBits(header.contentBits) {
+    memory.acquire(HuffmanMemory::TREE_BYTES + (blockChecksums.size() + syncOffsets.size()) * sizeof(uint32_t));
+    const bool useTable = buildTable();
+    memory.acquire(table.size() * sizeof(TableEntry));
+    const Kernel kernel = useTable ? &HuffmanDecoder::decodeTable : &HuffmanDecoder::walkTree;
+    const unsigned threads = std::max(1u, options.threads);
+    statistics.blockSize = blockSize;
+
+    // Each thread holds one block of output and the content bits it was decoded from,
+    // sized from the sync table rather than from the declared block size alone.
+    const uint64_t blockBits = syncOffsets.empty() ? 0 : maxSyncedBits();
+    const uint64_t perThread = std::min<uint64_t>(blockSize, blockBits) + (blockBits + 7) / 8 + 1;
+    const std::size_t available = memory.available();
+    const std::size_t fit = available > 16 ? (available - 16) / perThread : 0;
+    const std::size_t batch = std::min<std::size_t>({threads, syncOffsets.size(), fit});
+
+    if (threads > 1 && batch >= 2) {
+        statistics.bufferSize = batch * perThread + 16;
+        memory.acquire(statistics.bufferSize);
+        streamSynced(kernel, batch, in, out);
+    } else if (threads > 1 && syncOffsets.empty() && options.maxMemory == 0) {
+        // Speculation needs all content at once.
+        const std::size_t contentBytes = (totalBits + 7) / 8;
+        statistics.bufferSize = contentBytes + 8;
+        memory.acquire(statistics.bufferSize);
+        packed.assign(statistics.bufferSize, 0);
+        in.read(reinterpret_cast<char*>(packed.data()), contentBytes);
+        if (static_cast<std::size_t>(in.gcount()) != contentBytes) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        contentBits = totalBits;
+        decodeSpeculative(kernel, threads);
+        out.write(res.data(), res.size());
+        std::string().swap(res);
+    } else {
+        statistics.bufferSize = memory.bufferSize(2);
+        memory.acquire(2 * statistics.bufferSize + 8);
+        streamSequential(kernel, statistics.bufferSize, in, out);
+    }
+
+    if (!out) {
+        throw std::runtime_error("Failed to write output");
+    }
+    statistics.peakMemory = memory.peak();
 }
 
 std::string HuffmanDecoder::result() const {
     return res;
 }
 
-void HuffmanDecoder::decodeString(std::deque<bool> content) {
-    while (!content.empty()) {
-        tree.descend(content.front());
-        content.pop_front();
+HuffmanStats HuffmanDecoder::stats() const {
+    return statistics;
+}
+
+void HuffmanDecoder::decodeString() {
+    // Checksums are verified in the same pass as decoding.
+    HuffmanChecksum blockCrc, streamCrc;
+    std::size_t block = 0;
+    std::size_t inBlock = 0;
+
+    for (std::size_t i = 0; i < contentBits; ++i) {
+        const bool bit = (packed[i / 8] >> (7 - i % 8)) & 1;
+        if (!tree.descend(bit)) {
+            throw std::runtime_error("Invalid content: code walks off tree");
+        }
         // Check for leaf.
         if (tree.isLeaf()) {
-            res += tree.getChar();
+            const char c = tree.getChar();
+            res += c;
             tree.reset();
+
+            if (blockSize != 0) {
+                blockCrc.update(c);
+                streamCrc.update(c);
+                if (++inBlock == blockSize) {
+                    verifyBlock(block++, blockCrc.value());
+                    blockCrc.reset();
+                    inBlock = 0;
+                }
+            }
+        }
+    }
+
+    // Content must end on a code boundary.
+    if (!tree.atRoot()) {
+        throw std::runtime_error("Invalid content: truncated code");
+    }
+
+    // File carries no checksums.
+    if (blockSize == 0) {
+        return;
+    }
+
+    // Trailing partial block.
+    if (inBlock != 0) {
+        verifyBlock(block++, blockCrc.value());
+    }
+    verifyStream(block, streamCrc.value());
+}
+
+/**
+ * @brief Build the lookup table for the table kernels.
+ * @return False if the longest code does not fit in MAX_TABLE_BITS.
+ */
+bool HuffmanDecoder::buildTable() {
+    std::unordered_map<char, std::vector<bool>> codeMap = tree.getCodeMap();
+    tree.reset();
+
+    maxCodeLength = 0;
+    for (const auto& pair : codeMap) {
+        maxCodeLength = std::max(maxCodeLength, pair.second.size());
+    }
+
+    // Use the smallest of a few widths that holds every code, to keep the table in cache.
+    tableBits = 0;
+    for (const unsigned bits : {8u, 10u, MAX_TABLE_BITS}) {
+        if (maxCodeLength <= bits) {
+            tableBits = bits;
+            break;
         }
     }
+    if (tableBits == 0) {
+        return false;
+    }
+
+    // Every index whose top bits match a code maps to that code.
+    table.assign(std::size_t(1) << tableBits, TableEntry{0, 0});
+    for (const auto& pair : codeMap) {
+        std::size_t code = 0;
+        for (const bool b : pair.second) {
+            code = (code << 1) | b;
+        }
+        const unsigned length = pair.second.size();
+        const std::size_t first = code << (tableBits - length);
+        const std::size_t count = std::size_t(1) << (tableBits - length);
+        for (std::size_t i = first; i < first + count; ++i) {
+            table[i] = TableEntry{pair.first, static_cast<uint8_t>(length)};
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Decode content block by block with a table kernel.
+ * @details The kernel is selected once. Each block is checksummed right
+ * after decoding while it is still in cache.
+ */
+void HuffmanDecoder::decodeBlocks(Kernel kernel) {
+    const std::size_t chunk = blockSize != 0 ? blockSize : HuffmanFile::DEFAULT_BLOCK_SIZE;
+    // Each code is at least one bit long, which bounds the output for untrusted headers.
+    if (blockSize != 0) {
+        res.reserve(std::min<uint64_t>(uint64_t(blockSize) * blockChecksums.size(), contentBits));
+    }
+    HuffmanChecksum streamCrc;
+    std::size_t block = 0;
+    std::size_t bitPos = 0;
+
+    while (bitPos < contentBits) {
+        // A block has at most one character per remaining bit.
+        const std::size_t cap = std::min(chunk, contentBits - bitPos);
+        const std::size_t begin = res.size();
+        res.resize(begin + cap);
+        const std::size_t n = (this->*kernel)(&res[begin], cap, bitPos, contentBits);
+        res.resize(begin + n);
+
+        if (blockSize != 0) {
+            HuffmanChecksum blockCrc;
+            blockCrc.update(&res[begin], n);
+            streamCrc.update(&res[begin], n);
+            verifyBlock(block++, blockCrc.value());
+        }
+    }
+
+    // File carries no checksums.
+    if (blockSize == 0) {
+        return;
+    }
+
+    verifyStream(block, streamCrc.value());
+}
+
+namespace {
+
+// Run f(0) .. f(threads - 1) concurrently, f(0) on the calling thread.
+template <typename F>
+void runParallel(unsigned threads, F f) {
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) {
+        pool.emplace_back(f, t);
+    }
+    f(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+}  // namespace
+
+// Decode all blocks in parallel, each starting from its sync point.
+void HuffmanDecoder::decodeSynced(Kernel kernel, unsigned threads) {
+    const std::size_t blocks = syncOffsets.size();
+    statistics.threads = std::min<std::size_t>(threads, blocks);
+
+    // Read validated that all but the last block fit in content bits.
+    // The last block has at most one character per remaining bit.
+    const std::size_t lastCap = std::min<std::size_t>(blockSize, totalBits - syncOffsets.back());
+    res.resize((blocks - 1) * blockSize + lastCap);
+    res.resize(decodeSyncedBlocks(kernel, threads, 0, blocks, 0, res.data()));
+
+    HuffmanChecksum streamCrc;
+    streamCrc.update(res.data(), res.size());
+    verifyStream(blocks, streamCrc.value());
+}
+
+/**
+ * @brief Decode blocks first .. last - 1 in parallel, each starting from its sync point.
+ * @details Each thread takes a contiguous range of blocks. A block must end
+ * exactly at the next sync point, so a bad sync table is caught like bad content.
+ * @param bitBase Content bit position of packed[0].
+ * @param out Output for the blocks, blockSize characters apart.
+ * @return Number of characters decoded.
+ */
+std::size_t HuffmanDecoder::decodeSyncedBlocks(Kernel kernel, unsigned threads, std::size_t first, std::size_t last, std::size_t bitBase, char* out) {
+    const std::size_t blocks = last - first;
+    threads = std::min<std::size_t>(threads, blocks);
+    std::size_t lastCount = blockSize;
+    std::vector<std::exception_ptr> errors(threads);
+
+    runParallel(threads, [&](unsigned t) {
+        try {
+            for (std::size_t b = first + t * blocks / threads; b < first + (t + 1) * blocks / threads; ++b) {
+                const bool isLast = b + 1 == syncOffsets.size();
+                const std::size_t end = (isLast ? totalBits : syncOffsets[b + 1]) - bitBase;
+                const std::size_t cap = isLast ? std::min<std::size_t>(blockSize, totalBits - syncOffsets[b]) : blockSize;
+                char* blockOut = out + (b - first) * blockSize;
+                std::size_t bitPos = syncOffsets[b] - bitBase;
+                const std::size_t n = (this->*kernel)(blockOut, cap, bitPos, end);
+                if (bitPos != end || (!isLast && n != blockSize)) {
+                    throw std::runtime_error("Sync point mismatch in block " + std::to_string(b));
+                }
+                if (isLast) {
+                    lastCount = n;
+                }
+
+                HuffmanChecksum blockCrc;
+                blockCrc.update(blockOut, n);
+                verifyBlock(b, blockCrc.value());
+            }
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    });
+
+    // Report the error in the lowest block.
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    return (blocks - 1) * blockSize + lastCount;
+}
+
+/**
+ * @brief Decode from in to out in batches of one block per thread.
+ * @details Each batch reads the content between its first and last sync
+ * point, so only the batch is held in memory.
+ */
+void HuffmanDecoder::streamSynced(Kernel kernel, unsigned threads, std::istream& in, std::ostream& out) {
+    const std::size_t blocks = syncOffsets.size();
+    const std::istream::pos_type contentStart = in.tellg();
+    statistics.threads = threads;
+
+    // A full block takes between 1 and maxCodeLength bits per character, so
+    // once checked, blockSize characters fit the bits of the longest block.
+    const uint64_t blockBits = maxSyncedBits();
+    for (std::size_t b = 0; b + 1 < blocks; ++b) {
+        const uint64_t bits = syncOffsets[b + 1] - syncOffsets[b];
+        if (bits < blockSize || bits > uint64_t(blockSize) * maxCodeLength) {
+            throw std::runtime_error("Sync point mismatch in block " + std::to_string(b));
+        }
+    }
+    packed.assign(threads * ((blockBits + 7) / 8 + 1) + 16, 0);
+    std::vector<char> output(threads * blockSize);
+
+    HuffmanChecksum streamCrc;
+    for (std::size_t first = 0; first < blocks; first += threads) {
+        const std::size_t last = std::min<std::size_t>(first + threads, blocks);
+        const std::size_t startByte = syncOffsets[first] / 8;
+        const std::size_t endBit = last == blocks ? totalBits : syncOffsets[last];
+        const std::size_t bytes = (endBit + 7) / 8 - startByte;
+        // The last block is bounded by the characters it may hold.
+        if (bytes + 8 > packed.size()) {
+            throw std::runtime_error("Sync point mismatch in block " + std::to_string(last - 1));
+        }
+
+        in.seekg(contentStart + std::streamoff(startByte));
+        in.read(reinterpret_cast<char*>(packed.data()), bytes);
+        if (static_cast<std::size_t>(in.gcount()) != bytes) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        std::fill_n(packed.begin() + bytes, 8, 0);
+        contentBits = endBit - startByte * 8;
+
+        const std::size_t n = decodeSyncedBlocks(kernel, threads, first, last, startByte * 8, output.data());
+        streamCrc.update(output.data(), n);
+        out.write(output.data(), n);
+    }
+    verifyStream(blocks, streamCrc.value());
+}
+
+// Content bits of the longest synced block, at most what blockSize characters may take.
+uint64_t HuffmanDecoder::maxSyncedBits() const {
+    uint64_t longest = totalBits - syncOffsets.back();
+    for (std::size_t b = 0; b + 1 < syncOffsets.size(); ++b) {
+        longest = std::max<uint64_t>(longest, syncOffsets[b + 1] - syncOffsets[b]);
+    }
+    return std::min<uint64_t>(longest, uint64_t(blockSize) * maxCodeLength);
+}
+
+/**
+ * @brief Decode from in to out through a sliding window of content.
+ * @details The window is refilled once the kernel gets within one code of
+ * its end, so no code is ever cut.
+ */
+void HuffmanDecoder::streamSequential(Kernel kernel, std::size_t bufferSize, std::istream& in, std::ostream& out) {
+    const std::size_t contentBytes = (totalBits + 7) / 8;
+    packed.assign(bufferSize + 8, 0);
+    std::vector<char> output(bufferSize);
+    statistics.threads = 1;
+
+    HuffmanChecksum blockCrc, streamCrc;
+    std::size_t block = 0;
+    std::size_t inBlock = 0;
+    std::size_t base = 0;    // Content byte held in packed[0].
+    std::size_t have = 0;    // Content bytes held in packed.
+    std::size_t bitPos = 0;  // Relative to packed[0].
+
+    while (base * 8 + bitPos < totalBits) {
+        // Keep the unread bytes and refill.
+        const std::size_t used = bitPos / 8;
+        std::copy(packed.begin() + used, packed.begin() + have, packed.begin());
+        base += used;
+        have -= used;
+        bitPos -= used * 8;
+        const std::size_t want = std::min(bufferSize - have, contentBytes - base - have);
+        in.read(reinterpret_cast<char*>(packed.data() + have), want);
+        if (static_cast<std::size_t>(in.gcount()) != want) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        have += want;
+        std::fill_n(packed.begin() + have, 8, 0);
+
+        const bool atEnd = base + have == contentBytes;
+        contentBits = atEnd ? totalBits - base * 8 : have * 8;
+        const std::size_t endBit = atEnd ? contentBits : contentBits - maxCodeLength;
+
+        while (bitPos < endBit) {
+            const std::size_t cap = blockSize != 0 ? std::min<std::size_t>(bufferSize, blockSize - inBlock) : bufferSize;
+            const std::size_t n = (this->*kernel)(output.data(), cap, bitPos, endBit);
+            if (blockSize != 0) {
+                blockCrc.update(output.data(), n);
+                streamCrc.update(output.data(), n);
+                inBlock += n;
+                if (inBlock == blockSize) {
+                    verifyBlock(block++, blockCrc.value());
+                    blockCrc.reset();
+                    inBlock = 0;
+                }
+            }
+            out.write(output.data(), n);
+        }
+    }
+
+    // File carries no checksums.
+    if (blockSize == 0) {
+        return;
+    }
+
+    // Trailing partial block.
+    if (inBlock != 0) {
+        verifyBlock(block++, blockCrc.value());
+    }
+    verifyStream(block, streamCrc.value());
+}
+
+/**
+ * @brief Decode a single stream in parallel without sync points.
+ * @details Content is split into chunks by bit position. Every chunk is
+ * decoded speculatively from its first bit, recording code boundaries near
+ * its start. Then, in order, the true entry point of each chunk (where the
+ * previous chunk left off) is decoded one code at a time until it lands on
+ * a recorded boundary. Huffman codes self-synchronize, so this usually
+ * takes a few codes, and the rest of the speculative output is exact.
+ * Chunks that do not synchronize within the window are decoded again.
+ */
+void HuffmanDecoder::decodeSpeculative(Kernel kernel, unsigned threads) {
+    struct Chunk {
+        std::size_t begin;
+        std::size_t end;
+        std::string out;
+        std::vector<std::size_t> boundaries;  // Bit position before each code in out, then exit position.
+        std::size_t exit;                     // First code boundary at or after end.
+        bool failed = false;                  // Speculation ran into invalid content.
+    };
+
+    const std::size_t chunkCount = std::max<std::size_t>(1, std::min<std::size_t>(threads, contentBits / MIN_CHUNK_BITS));
+    statistics.threads = chunkCount;
+    std::vector<Chunk> chunks(chunkCount);
+    for (std::size_t i = 0; i < chunkCount; ++i) {
+        chunks[i].begin = i * contentBits / chunkCount;
+        chunks[i].end = (i + 1) * contentBits / chunkCount;
+    }
+
+    // Speculate.
+    runParallel(chunkCount, [&](unsigned i) {
+        Chunk& chunk = chunks[i];
+        try {
+            std::size_t bitPos = chunk.begin;
+            chunk.boundaries.push_back(bitPos);
+            while (bitPos < chunk.end && bitPos < chunk.begin + SYNC_WINDOW_BITS) {
+                char c;
+                (this->*kernel)(&c, 1, bitPos, chunk.end);
+                chunk.out += c;
+                chunk.boundaries.push_back(bitPos);
+            }
+            decodeRun(kernel, chunk.out, bitPos, chunk.end);
+            chunk.exit = bitPos;
+        } catch (std::runtime_error&) {
+            chunk.failed = true;
+        }
+    });
+
+    // Speculated output stays live until its chunk is verified.
+    const auto chunkBytes = [](const Chunk& chunk) {
+        return chunk.out.capacity() + chunk.boundaries.capacity() * sizeof(std::size_t);
+    };
+    for (const Chunk& chunk : chunks) {
+        memory.acquire(chunkBytes(chunk));
+    }
+
+    // Verify each guess against where the previous chunk really ended.
+    std::size_t bitPos = 0;
+    for (Chunk& chunk : chunks) {
+        const std::size_t resCapacity = res.capacity();
+        bool synced = false;
+        while (!chunk.failed && bitPos < chunk.end && bitPos <= chunk.boundaries.back()) {
+            const auto it = std::lower_bound(chunk.boundaries.begin(), chunk.boundaries.end(), bitPos);
+            if (*it == bitPos) {
+                res.append(chunk.out, it - chunk.boundaries.begin(), std::string::npos);
+                bitPos = chunk.exit;
+                synced = true;
+                break;
+            }
+            char c;
+            (this->*kernel)(&c, 1, bitPos, chunk.end);
+            res += c;
+        }
+        if (!synced) {
+            decodeRun(kernel, res, bitPos, chunk.end);
+        }
+        memory.acquire(res.capacity() - resCapacity);
+        memory.release(chunkBytes(chunk));
+        std::string().swap(chunk.out);
+        std::vector<std::size_t>().swap(chunk.boundaries);
+    }
+
+    verifyChecksums();
+}
+
+// Decode from bitPos until a code ends at or after endBit, appending to out.
+void HuffmanDecoder::decodeRun(Kernel kernel, std::string& out, std::size_t& bitPos, std::size_t endBit) const {
+    const std::size_t chunk = HuffmanFile::DEFAULT_BLOCK_SIZE;
+    while (bitPos < endBit) {
+        const std::size_t begin = out.size();
+        out.resize(begin + chunk);
+        const std::size_t n = (this->*kernel)(&out[begin], chunk, bitPos, endBit);
+        out.resize(begin + n);
+    }
+}
+
+// Verify checksums of already decoded output.
+void HuffmanDecoder::verifyChecksums() const {
+    // File carries no checksums.
+    if (blockSize == 0) {
+        return;
+    }
+
+    HuffmanChecksum streamCrc;
+    std::size_t block = 0;
+    for (std::size_t begin = 0; begin < res.size(); begin += blockSize) {
+        const std::size_t n = std::min<std::size_t>(blockSize, res.size() - begin);
+        HuffmanChecksum blockCrc;
+        blockCrc.update(&res[begin], n);
+        streamCrc.update(&res[begin], n);
+        verifyBlock(block++, blockCrc.value());
+    }
+    verifyStream(block, streamCrc.value());
+}
+
+/**
+ * @brief Tree walk kernel, for codes too long for the table kernels.
+ * @details Same contract as decodeTable. Walks its own node pointer instead
+ * of the tree's traversal state, so that threads may share the decoder.
+ */
+std::size_t HuffmanDecoder::walkTree(char* out, std::size_t maxSymbols, std::size_t& bitPos, std::size_t endBit) const {
+    const HuffmanTree::TreeNode* root = tree.treePtr.get();
+    std::size_t pos = bitPos;
+    std::size_t n = 0;
+
+    while (n < maxSymbols && pos < endBit) {
+        const HuffmanTree::TreeNode* node = root;
+        do {
+            if (pos >= contentBits) {
+                throw std::runtime_error("Invalid content: truncated code");
+            }
+            const bool bit = (packed[pos / 8] >> (7 - pos % 8)) & 1;
+            ++pos;
+            node = bit ? node->one.get() : node->zero.get();
+            if (node == nullptr) {
+                throw std::runtime_error("Invalid content: code walks off tree");
+            }
+        } while (node->one != nullptr || node->zero != nullptr);
+        out[n++] = node->ch;
+    }
+
+    bitPos = pos;
+    return n;
+}
+
+namespace {
+
+// Load 8 bytes as a big-endian word, so the next content bit is the MSB.
+inline uint64_t loadBits(const uint8_t* p) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return __builtin_bswap64(word);
+#else
+    uint64_t word = 0;
+    for (int i = 0; i < 8; ++i) {
+        word = (word << 8) | p[i];
+    }
+    return word;
+#endif
+}
+
+}  // namespace
+
+/**
+ * @brief Table decode kernel.
+ * @param out Output buffer of at least maxSymbols characters.
+ * @param maxSymbols Stop after this many characters.
+ * @param bitPos Content bit position, advanced past decoded codes.
+ * @param endBit Stop once a code ends at or after this bit position.
+ * @return Number of characters decoded.
+ */
+std::size_t HuffmanDecoder::decodeTable(char* out, std::size_t maxSymbols, std::size_t& bitPos, std::size_t endBit) const {
+    const unsigned bits = tableBits;
+    // A load shifted by up to 7 bits leaves at least 57 valid bits, enough for this many codes.
+    const unsigned perLoad = 57 / bits;
+    const uint8_t* buf = packed.data();
+    const TableEntry* tbl = table.data();
+    // Work on locals: stores through out may alias members and bitPos.
+    const std::size_t end = contentBits;
+    std::size_t pos = bitPos;
+    std::size_t n = 0;
+
+    // Fast path: every code in the batch lies within content and starts before endBit.
+    const std::size_t fastEnd = std::min(end, endBit);
+    while (n + perLoad <= maxSymbols && pos + perLoad * bits <= fastEnd) {
+        uint64_t window = loadBits(buf + (pos >> 3)) << (pos & 7);
+#pragma GCC unroll 8
+        for (unsigned k = 0; k < perLoad; ++k) {
+            const TableEntry e = tbl[window >> (64 - bits)];
+            out[n++] = e.ch;
+            window <<= e.length;
+            pos += e.length;
+        }
+    }
+
+    // Tail: one code at a time.
+    while (n < maxSymbols && pos < endBit) {
+        const uint64_t window = loadBits(buf + (pos >> 3)) << (pos & 7);
+        const TableEntry e = tbl[window >> (64 - bits)];
+        if (pos + e.length > end) {
+            throw std::runtime_error("Invalid content: truncated code");
+        }
+        out[n++] = e.ch;
+        pos += e.length;
+    }
+
+    bitPos = pos;
+    return n;
+}
+
+void HuffmanDecoder::verifyStream(std::size_t blocks, uint32_t checksum) const {
+    if (blocks != blockChecksums.size()) {
+        throw std::runtime_error("Checksum mismatch: expected " + std::to_string(blockChecksums.size()) +
+                                 " blocks, decoded " + std::to_string(blocks));
+    }
+    if (checksum != streamChecksum) {
+        throw std::runtime_error("Checksum mismatch in stream");
+    }
+}
+
+void HuffmanDecoder::verifyBlock(std::size_t block, uint32_t checksum) const {
+    if (block >= blockChecksums.size()) {
+        throw std::runtime_error("Checksum mismatch: unexpected block " + std::to_string(block));
+    }
+    if (blockChecksums[block] != checksum) {
+        throw std::runtime_error("Checksum mismatch in block " + std::to_string(block));
+    }
 }
 
 /////////////////
 // HuffmanFile //
 /////////////////
 
+namespace {
+
+// File integers are little-endian. Converts in either direction.
+inline uint32_t littleEndian(uint32_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(word);
+#else
+    return word;
+#endif
+}
+
+void writeWords(std::ostream& os, const uint32_t* words, std::size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (std::size_t i = 0; i < count; ++i) {
+        const uint32_t word = littleEndian(words[i]);
+        os.write(reinterpret_cast<const char*>(&word), sizeof(word));
+    }
+#else
+    os.write(reinterpret_cast<const char*>(words), count * sizeof(uint32_t));
+#endif
+}
+
+}  // namespace
+
 HuffmanFile::HuffmanFile() {}
 
 HuffmanFile::HuffmanFile(const std::string& path) {
@@ -277,42 +1288,148 @@ HuffmanFile::HuffmanFile(const std::string& path) {
         throw std::runtime_error("Failed to open file: " + path);
     }
 
+    read(ifs);
+    ifs.close();
+}
+
+HuffmanFile::HuffmanFile(std::istream& is) {
+    read(is);
+}
+
+// Read and validate the header, leaving is at the start of the content.
+HuffmanFile HuffmanFile::readHeader(std::istream& is, std::size_t maxMemory) {
+    HuffmanFile file;
+    file.read(is, false, maxMemory);
+    return file;
+}
+
+/**
+ * @brief Read and validate an encoded file.
+ * @details All sizes are checked against the remaining stream length before
+ * anything is allocated, so a malformed header cannot exhaust memory.
+ * @param readContent If false, stop before the content. contentBits is still set.
+ * @param maxMemory Cap for the tree and block tables, checked before they are allocated. 0 for no cap.
+ * @throws std::runtime_error on malformed or truncated input.
+ */
+void HuffmanFile::read(std::istream& is, bool readContent, std::size_t maxMemory) {
+    // Find stream length.
+    std::istream::pos_type begin = is.tellg();
+    is.seekg(0, std::ios::end);
+    std::istream::pos_type end = is.tellg();
+    is.seekg(begin);
+    if (begin == std::istream::pos_type(-1) || end == std::istream::pos_type(-1)) {
+        throw std::runtime_error("Invalid file format: stream is not seekable");
+    }
+    uint64_t remaining = static_cast<uint64_t>(end - begin);
+
+    // Read exactly n bytes or fail.
+    auto readBytes = [&is, &remaining](void* dst, uint64_t n) {
+        if (n > remaining) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        is.read(reinterpret_cast<char*>(dst), n);
+        if (static_cast<uint64_t>(is.gcount()) != n) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        remaining -= n;
+    };
+
+    // Read count little-endian words.
+    auto readWords = [&readBytes](uint32_t* dst, uint64_t count) {
+        readBytes(dst, count * sizeof(uint32_t));
+        for (uint64_t i = 0; i < count; ++i) {
+            dst[i] = littleEndian(dst[i]);
+        }
+    };
+
     // Check magic bytes.
+    // "HUFF" files carry no checksums, "HUF2" files carry a checksum table after the size info,
+    // "HUF3" files also carry a sync table after the checksum table.
     char magic[4];
-    ifs.read(magic, 4);
-    if (std::string(magic, 4) != "HUFF") {
+    readBytes(magic, 4);
+    std::string magicStr(magic, 4);
+    if (magicStr != "HUFF" && magicStr != "HUF2" && magicStr != "HUF3") {
         throw std::runtime_error("Invalid file format: missing HUFF magic header");
     }
 
     // Read metadata.
     uint32_t treeBitsSize, leafCount, contentSize;
-    ifs.read(reinterpret_cast<char*>(&treeBitsSize), sizeof(treeBitsSize));
-    ifs.read(reinterpret_cast<char*>(&leafCount), sizeof(leafCount));
-    ifs.read(reinterpret_cast<char*>(&contentSize), sizeof(contentSize));
+    readWords(&treeBitsSize, 1);
+    readWords(&leafCount, 1);
+    readWords(&contentSize, 1);
+
+    // A full binary tree over at most 256 distinct bytes.
+    if (leafCount < 2 || leafCount > MAX_LEAVES || treeBitsSize != 2 * leafCount - 1) {
+        throw std::runtime_error("Invalid file format: bad tree size");
+    }
+
+    // Read checksums.
+    if (magicStr != "HUFF") {
+        uint32_t blockCount;
+        readWords(&blockSize, 1);
+        readWords(&blockCount, 1);
+        readWords(&streamChecksum, 1);
+        if (blockSize == 0) {
+            throw std::runtime_error("Invalid file format: bad checksum block size");
+        }
+        if (static_cast<uint64_t>(blockCount) * sizeof(uint32_t) > remaining) {
+            throw std::runtime_error("Invalid file format: truncated file");
+        }
+        // Every block but the last is full, and each character takes at least one bit.
+        if (blockCount != 0 && static_cast<uint64_t>(blockCount - 1) * blockSize >= contentSize) {
+            throw std::runtime_error("Invalid file format: bad checksum block count");
+        }
+        const uint64_t tables = (magicStr == "HUF3" ? 2 : 1) * static_cast<uint64_t>(blockCount) * sizeof(uint32_t);
+        HuffmanMemory(maxMemory).acquire(HuffmanMemory::TREE_BYTES + tables);
+        blockChecksums.resize(blockCount);
+        readWords(blockChecksums.data(), blockCount);
+    }
+
+    // Read sync table.
+    if (magicStr == "HUF3") {
+        uint32_t blockCount = blockChecksums.size();
+        syncOffsets.resize(blockCount);
+        readWords(syncOffsets.data(), blockCount);
+        // Blocks start at bit 0 and are non-empty.
+        for (std::size_t i = 0; i < syncOffsets.size(); ++i) {
+            uint32_t prev = i == 0 ? 0 : syncOffsets[i - 1];
+            if ((i == 0 ? syncOffsets[i] != 0 : syncOffsets[i] <= prev) || syncOffsets[i] >= contentSize) {
+                throw std::runtime_error("Invalid file format: bad sync table");
+            }
+        }
+    }
+
+    // Check remaining sizes before allocating.
+    uint64_t treeBytes = (static_cast<uint64_t>(treeBitsSize) + 7) / 8;
+    uint64_t contentBytes = (static_cast<uint64_t>(contentSize) + 7) / 8;
+    if (treeBytes + leafCount + contentBytes > remaining) {
+        throw std::runtime_error("Invalid file format: truncated file");
+    }
 
     // Read treeBits.
-    std::size_t treeBytes = (treeBitsSize + 7) / 8;
     std::vector<uint8_t> treeBytesBuffer(treeBytes);
-    ifs.read(reinterpret_cast<char*>(treeBytesBuffer.data()), treeBytes);
+    readBytes(treeBytesBuffer.data(), treeBytes);
     treeBits = unpackBits(treeBytesBuffer, treeBitsSize);
 
     // Read leaves.
-    for (uint32_t i = 0; i < leafCount; ++i) {
-        char c;
-        ifs.read(&c, 1);
-        leaves.push_back(c);
+    std::vector<char> leavesBuffer(leafCount);
+    readBytes(leavesBuffer.data(), leafCount);
+    leaves.assign(leavesBuffer.begin(), leavesBuffer.end());
+    contentBits = contentSize;
+    if (!readContent) {
+        return;
     }
 
     // Read content bits.
-    std::size_t contentBytes = (contentSize + 7) / 8;
     std::vector<uint8_t> contentBuffer(contentBytes);
-    ifs.read(reinterpret_cast<char*>(contentBuffer.data()), contentBytes);
-    content = unpackBits(contentBuffer, contentSize);
-
-    ifs.close();
+    readBytes(contentBuffer.data(), contentBytes);
+    content = std::move(contentBuffer);
 }
 
 std::deque<bool> HuffmanFile::unpackBits(const std::vector<uint8_t>& bytes, std::size_t bitCount) {
+    if (bitCount > bytes.size() * 8) {
+        throw std::runtime_error("Invalid file format: bit count exceeds buffer");
+    }
     std::deque<bool> bits;
     for (std::size_t i = 0; i < bitCount; ++i) {
         std::size_t byteIndex = i / 8;
@@ -330,58 +1447,80 @@ void HuffmanFile::write(const std::string& path) {
         throw std::runtime_error("Failed to open file: " + path);
     }
 
-    // Write magic bytes "HUFF".
-    ofs.write("HUFF", 4);
+    write(ofs);
+    ofs.close();
+}
+
+void HuffmanFile::write(std::ostream& os) const {
+    writeHeader(os);
+    // Write content.
+    os.write(reinterpret_cast<const char*>(content.data()), content.size());
+}
+
+// Write everything but the content.
+void HuffmanFile::writeHeader(std::ostream& os) const {
+    // Write magic bytes. Files without checksums stay in the original "HUFF" format.
+    os.write(blockSize == 0 ? "HUFF" : syncOffsets.empty() ? "HUF2" : "HUF3", 4);
     // Write size info.
     uint32_t treeBitsSize = treeBits.size();  // In bits.
     uint32_t leafCount = leaves.size();       // In bytes.
-    uint32_t contentSize = content.size();    // In bits.
+    uint32_t contentSize = contentBits;       // In bits.
 
-    ofs.write(reinterpret_cast<const char*>(&treeBitsSize), sizeof(treeBitsSize));
-    ofs.write(reinterpret_cast<const char*>(&leafCount), sizeof(leafCount));
-    ofs.write(reinterpret_cast<const char*>(&contentSize), sizeof(contentSize));
+    writeWords(os, &treeBitsSize, 1);
+    writeWords(os, &leafCount, 1);
+    writeWords(os, &contentSize, 1);
 
-    // Write tree data and content data.
-    // Pack treeBits into bytes.
+    // Write checksums.
+    if (blockSize != 0) {
+        uint32_t blockCount = blockChecksums.size();
+        writeWords(os, &blockSize, 1);
+        writeWords(os, &blockCount, 1);
+        writeWords(os, &streamChecksum, 1);
+        writeWords(os, blockChecksums.data(), blockCount);
+    }
 
-    for (std::size_t i = 0; i < treeBits.size(); i += 8) {
-        uint8_t byte = 0;
-        for (int b = 0; b < 8 && i + b < treeBits.size(); ++b) {
-            if (treeBits[i + b]) {
-                byte |= (1 << (7 - b));
-            }
-        }
-        ofs.put(byte);
+    // Write sync table.
+    if (blockSize != 0 && !syncOffsets.empty()) {
+        writeWords(os, syncOffsets.data(), syncOffsets.size());
     }
 
+    // Write tree data.
+    // Pack treeBits into bytes.
+    std::vector<uint8_t> treeBytes = packBits(treeBits);
+    os.write(reinterpret_cast<const char*>(treeBytes.data()), treeBytes.size());
+
     // Write leaves.
     for (const char c : leaves) {
-        ofs.put(c);
+        os.put(c);
     }
+}
 
-    // Pack content bits into bytes
-    for (size_t i = 0; i < content.size(); i += 8) {
-        uint8_t byte = 0;
-        for (int b = 0; b < 8 && i + b < content.size(); ++b) {
-            if (content[i + b])
-                byte |= (1 << (7 - b));
+std::vector<uint8_t> HuffmanFile::packBits(const std::deque<bool>& bits) {
+    std::vector<uint8_t> bytes((bits.size() + 7) / 8, 0);
+    for (std::size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i]) {
+            bytes[i / 8] |= (1 << (7 - i % 8));
         }
-        ofs.put(byte);
     }
-
-    ofs.close();
+    return bytes;
 }
 
 // Return size of actual file in bytes.
 std::size_t HuffmanFile::size() const {
     std::size_t size = 4;
 
+    // Size info.
+    size += 3 * sizeof(uint32_t);
+    // Checksums.
+    if (blockSize != 0) {
+        size += (3 + blockChecksums.size() + syncOffsets.size()) * sizeof(uint32_t);
+    }
     // treeBits.
     size += (treeBits.size() + 7) / 8;
     // leaves.
     size += leaves.size();
     // content.
-    size += (content.size() + 7) / 8;
+    size += content.size();
 
     return size;
 }
@@ -394,7 +1533,19 @@ std::deque<char> HuffmanFile::getLeaves() {
     return leaves;
 }
 std::deque<bool> HuffmanFile::getContent() {
-    return content;
+    return unpackBits(content, contentBits);
+}
+uint32_t HuffmanFile::getBlockSize() {
+    return blockSize;
+}
+std::vector<uint32_t> HuffmanFile::getBlockChecksums() {
+    return blockChecksums;
+}
+uint32_t HuffmanFile::getStreamChecksum() {
+    return streamChecksum;
+}
+std::vector<uint32_t> HuffmanFile::getSyncOffsets() {
+    return syncOffsets;
 }
 
 HuffmanFile::HuffmanFile(std::deque<bool> treeBits,
@@ -402,6 +1553,7 @@ HuffmanFile::HuffmanFile(std::deque<bool> treeBits,
                          std::deque<bool> content) {
     this->treeBits = treeBits;
     this->leaves = leaves;
-    this->content = content;
+    this->content = packBits(content);
+    this->contentBits = content.size();
 }
 #endif
\ No newline at end of file
@@ -4,21 +4,83 @@
 #include <cstddef>
 #include <cstdint>
 #include <deque>
+#include <istream>
+#include <ostream>
 #include <memory>
 #include <queue>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #define HUFFMAN_DEBUG
 
+// CRC32C (Castagnoli) checksum, updated one byte at a time.
+class HuffmanChecksum {
+public:
+    HuffmanChecksum();
+
+    void reset();
+    void update(char c);
+    void update(const char* data, std::size_t size);
+    uint32_t value() const;
+
+    static uint32_t compute(const std::string& data);
+
+private:
+    uint32_t crc;
+};
+
+// Tracks the working set of large buffers against an optional cap.
+class HuffmanMemory {
+public:
+    static constexpr std::size_t DEFAULT_BUFFER_SIZE = 1 << 20;
+    static constexpr std::size_t MIN_BUFFER_SIZE = 4096;
+    static constexpr std::size_t TREE_BYTES = 2 * 256 * 64;  // Tree and code map of up to 256 leaves, roughly.
+
+    HuffmanMemory(std::size_t limit = 0);
+
+    void acquire(std::size_t bytes);
+    void release(std::size_t bytes);
+    std::size_t available() const;  // Bytes left under the cap. SIZE_MAX if uncapped.
+    std::size_t peak() const;
+    std::size_t bufferSize(unsigned share) const;
+
+private:
+    std::size_t limit;  // 0 for no cap.
+    std::size_t current = 0;
+    std::size_t peakBytes = 0;
+};
+
+// Reported by HuffmanEncoder and HuffmanDecoder.
+struct HuffmanStats {
+    std::size_t peakMemory = 0;  // Peak working set of buffers and tables in bytes, excluding the caller's input.
+    std::size_t bufferSize = 0;  // I/O buffer size for stream constructors, content buffer size otherwise.
+    uint32_t blockSize = 0;      // Checksum block size.
+    unsigned threads = 0;        // Threads used.
+};
+
 class HuffmanFile {
 private:
     std::deque<bool> treeBits;
     std::deque<char> leaves;
-    std::deque<bool> content;
+    std::vector<uint8_t> content;  // Packed content bits, MSB first.
+    std::size_t contentBits = 0;
+
+    uint32_t blockSize = 0;                // Input bytes per checksum block. 0 if file has no checksums.
+    std::vector<uint32_t> blockChecksums;  // CRC32C of each block of input.
+    uint32_t streamChecksum = 0;           // CRC32C of whole input.
+    std::vector<uint32_t> syncOffsets;     // Content bit offset where each block starts. Empty if not recorded.
+
     static std::deque<bool> unpackBits(const std::vector<uint8_t>& bytes, std::size_t bitCount);
+    static std::vector<uint8_t> packBits(const std::deque<bool>& bits);
+    static HuffmanFile readHeader(std::istream& is, std::size_t maxMemory);
+    void read(std::istream& is, bool readContent = true, std::size_t maxMemory = 0);
+    void writeHeader(std::ostream& os) const;
 
 public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static constexpr uint32_t MAX_LEAVES = 256;  // One leaf per distinct byte.
+
     // Befriend HuffmanTree, HuffmanEncoder, HuffmanDecoder.
     friend class HuffmanTree;
     friend class HuffmanEncoder;
@@ -26,12 +88,18 @@ public:
 
     HuffmanFile();
     HuffmanFile(const std::string& path);
+    HuffmanFile(std::istream& is);
     std::size_t size() const;
     void write(const std::string& path);
+    void write(std::ostream& os) const;
 #ifdef HUFFMAN_DEBUG
     std::deque<bool> getTreeBits();
     std::deque<char> getLeaves();
     std::deque<bool> getContent();
+    uint32_t getBlockSize();
+    std::vector<uint32_t> getBlockChecksums();
+    uint32_t getStreamChecksum();
+    std::vector<uint32_t> getSyncOffsets();
 
     HuffmanFile(std::deque<bool> treeBits,
                 std::deque<char> leaves,
@@ -39,21 +107,35 @@ public:
 #endif
 };
 
+// Stream and memory settings for HuffmanEncoder and HuffmanDecoder stream constructors.
+struct HuffmanOptions {
+    std::size_t maxMemory = 0;                             // Working set cap in bytes. 0 for no cap.
+    uint32_t blockSize = HuffmanFile::DEFAULT_BLOCK_SIZE;  // Encoder only. Shrunk to fit maxMemory.
+    bool syncPoints = true;                                // Encoder only.
+    unsigned threads = 1;                                  // Decoder only. Reduced to fit maxMemory.
+};
+
 class HuffmanTree {
 public:
     HuffmanTree(const std::string& content);
+    HuffmanTree(const std::unordered_map<char, uint64_t>& charFreqMap);
     HuffmanTree(const HuffmanFile& file);
 
     std::deque<bool> getTreeBits();
     std::deque<char> getLeaves();
+    std::unordered_map<char, std::vector<bool>> getCodeMap();
 
     void reset();
     bool isLeaf() const;
+    bool atRoot() const;
     char getChar() const;
     bool descend(bool direction);
     void ascend();
 
 private:
+    // HuffmanDecoder walks nodes directly so that threads may share the tree.
+    friend class HuffmanDecoder;
+
     struct TreeNode {
         char ch;
         std::shared_ptr<TreeNode> zero;
@@ -68,7 +150,9 @@ private:
 
     std::deque<std::shared_ptr<TreeNode>> tStack;  // Stack to record previous nodes during traversal.
 
-    void generateTree(const std::string& content);
+    static bool isLeafNode(const std::shared_ptr<TreeNode>& node);
+    void buildCodeMap(std::vector<bool>& code, std::unordered_map<char, std::vector<bool>>& codeMap);
+    void generateTree(const std::unordered_map<char, uint64_t>& charFreqMap);
     static void encodeTree(const std::shared_ptr<TreeNode> treePtr, std::deque<bool>& treeBits, std::deque<char>& leaves);
     static std::shared_ptr<TreeNode> decodeTree(std::deque<bool>& treeBits, std::deque<char>& leaves);
 };
@@ -76,26 +160,94 @@ private:
 class HuffmanEncoder {
 public:
     HuffmanFile result() const;
-    HuffmanEncoder(const std::string& content);
+    HuffmanStats stats() const;
+    HuffmanEncoder(const std::string& content,
+                   uint32_t blockSize = HuffmanFile::DEFAULT_BLOCK_SIZE,
+                   bool syncPoints = true);
+    // Encode in to out in two passes over in, within options.maxMemory.
+    // Both streams must be seekable. result() then holds no content.
+    HuffmanEncoder(std::istream& in, std::ostream& out, const HuffmanOptions& options = HuffmanOptions());
 
 private:
+    HuffmanMemory memory;  // Declared before tree, which is built from a counting pass.
+    std::unordered_map<char, uint64_t> charFreqMap;
     HuffmanTree tree;
     HuffmanFile res;
-
-    std::deque<bool> encodeString(const std::string& content);
-    void buildCodeMap(std::vector<bool>& code, std::unordered_map<char, std::vector<bool>>& codeMap);
+    HuffmanStats statistics;
+
+    // Encoding state.
+    std::unordered_map<char, std::vector<bool>> codeMap;
+    HuffmanChecksum blockCrc, streamCrc;
+    std::size_t inBlock = 0;
+    bool syncPoints = true;
+
+    static std::unordered_map<char, uint64_t> countChars(std::istream& in, HuffmanMemory& memory);
+    void beginEncode(uint32_t blockSize, bool syncPoints);
+    void encodeChunk(const char* data, std::size_t size);
+    void endEncode();
+    void flushContent(std::ostream& out, bool isLast);
 };
 
 class HuffmanDecoder {
 public:
+    enum class Mode {
+        Auto,  // Table kernel, tree walk if codes are too long.
+        Tree,  // Tree walk, one bit at a time.
+    };
+
+    static constexpr unsigned MAX_TABLE_BITS = 12;
+    static constexpr std::size_t MIN_CHUNK_BITS = 1 << 16;    // Smallest chunk worth a thread when speculating.
+    static constexpr std::size_t SYNC_WINDOW_BITS = 1 << 12;  // Code boundaries recorded per speculative chunk.
+
     std::string result() const;
-    HuffmanDecoder(const HuffmanFile& file);
+    HuffmanStats stats() const;
+    HuffmanDecoder(const HuffmanFile& file, Mode mode = Mode::Auto, unsigned threads = 1);
+    // Decode in to out within options.maxMemory. in must be seekable. result() is then empty.
+    // Output is written before checksums are verified, so discard out if this throws.
+    HuffmanDecoder(std::istream& in, std::ostream& out, const HuffmanOptions& options = HuffmanOptions());
 
 private:
+    struct TableEntry {
+        char ch;
+        uint8_t length;  // Code length in bits.
+    };
+
+    using Kernel = std::size_t (HuffmanDecoder::*)(char* out, std::size_t maxSymbols, std::size_t& bitPos, std::size_t endBit) const;
+
     HuffmanTree tree;
     std::string res;
-
-    void decodeString(std::deque<bool> content);
+    HuffmanMemory memory;
+    HuffmanStats statistics;
+
+    uint32_t blockSize;
+    std::vector<uint32_t> blockChecksums;
+    uint32_t streamChecksum;
+    std::vector<uint32_t> syncOffsets;
+
+    unsigned tableBits = 0;
+    std::size_t maxCodeLength = 0;
+    std::vector<TableEntry> table;  // Indexed by the next tableBits content bits.
+    std::vector<uint8_t> packed;    // Packed content, or a window of it, padded with 8 zero bytes.
+    std::size_t contentBits;        // Valid bits in packed.
+    std::size_t totalBits;          // Content bits in the whole file.
+
+    HuffmanDecoder(HuffmanFile header, std::istream& in, std::ostream& out, const HuffmanOptions& options);
+
+    void decodeString();
+    bool buildTable();
+    void decodeBlocks(Kernel kernel);
+    void decodeSynced(Kernel kernel, unsigned threads);
+    std::size_t decodeSyncedBlocks(Kernel kernel, unsigned threads, std::size_t first, std::size_t last, std::size_t bitBase, char* out);
+    void streamSequential(Kernel kernel, std::size_t bufferSize, std::istream& in, std::ostream& out);
+    void streamSynced(Kernel kernel, unsigned threads, std::istream& in, std::ostream& out);
+    uint64_t maxSyncedBits() const;
+    void decodeSpeculative(Kernel kernel, unsigned threads);
+    void decodeRun(Kernel kernel, std::string& out, std::size_t& bitPos, std::size_t endBit) const;
+    std::size_t decodeTable(char* out, std::size_t maxSymbols, std::size_t& bitPos, std::size_t endBit) const;
+    std::size_t walkTree(char* out, std::size_t maxSymbols, std::size_t& bitPos, std::size_t endBit) const;
+    void verifyChecksums() const;
+    void verifyBlock(std::size_t block, uint32_t checksum) const;
+    void verifyStream(std::size_t blocks, uint32_t checksum) const;
 };
 
 #endif
\ No newline at end of file
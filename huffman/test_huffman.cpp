@@ -1,11 +1,17 @@
 #define HUFFMAN_DEBUG
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <cstddef>
+#include <cstdlib>
 #include <deque>
+#include <fstream>
 #include <memory>
 #include <queue>
+#include <random>
+#include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "huffman.hpp"
 
 // Helper function to compare two deque<bool>
@@ -138,4 +144,452 @@ TEST(HuffmanEncoderDecoderTest, EncodeDecodeUniqueChars) {
     HuffmanFile file = encoder.result();
     HuffmanDecoder decoder(file);
     EXPECT_EQ(decoder.result(), content);
-}
\ No newline at end of file
+}
+
+// Known CRC32C check value.
+TEST(HuffmanChecksumTest, KnownValue) {
+    EXPECT_EQ(HuffmanChecksum::compute("123456789"), 0xE3069283u);
+}
+
+// Encoder splits input into checksum blocks.
+TEST(HuffmanEncoderTest, BlockChecksums) {
+    std::string content = "ABANANAABANDANA";
+    HuffmanEncoder he(content, 4);
+    HuffmanFile hf = he.result();
+
+    EXPECT_EQ(hf.getBlockSize(), 4u);
+    ASSERT_EQ(hf.getBlockChecksums().size(), 4u);
+    EXPECT_EQ(hf.getBlockChecksums()[0], HuffmanChecksum::compute("ABAN"));
+    EXPECT_EQ(hf.getBlockChecksums()[3], HuffmanChecksum::compute("ANA"));
+    EXPECT_EQ(hf.getStreamChecksum(), HuffmanChecksum::compute(content));
+}
+
+// Checksums survive a write / read round trip.
+TEST(HuffmanFileTest, WriteReadChecksums) {
+    std::string content = "this is a test string for huffman encoding and decoding";
+    std::string path = testing::TempDir() + "checksums.huff";
+    HuffmanEncoder(content, 8).result().write(path);
+
+    HuffmanFile hf(path);
+    EXPECT_EQ(hf.getBlockSize(), 8u);
+    EXPECT_EQ(hf.getBlockChecksums().size(), 7u);
+    HuffmanDecoder hd(hf);
+    EXPECT_EQ(hd.result(), content);
+}
+
+// Header integers are little-endian regardless of host byte order.
+TEST(HuffmanFileTest, LittleEndianHeader) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder("ABANANAABANDANA", 0x0102).result().write(ss);
+    std::string data = ss.str();
+
+    // Magic, 3 sizes, then blockSize.
+    EXPECT_EQ(data.substr(0, 4), "HUF3");
+    EXPECT_EQ(data.substr(16, 4), std::string("\x02\x01\x00\x00", 4));
+}
+
+// Corrupted content is reported with its block number.
+TEST(HuffmanDecoderTest, ChecksumMismatch) {
+    std::string content = "ABANANAABANDANA";
+    std::string path = testing::TempDir() + "corrupt.huff";
+    HuffmanFile hf = HuffmanEncoder(content, 4).result();
+    hf.write(path);
+
+    // Flip the first content bit. Content is the last 4 bytes of the file.
+    std::fstream fs(path, std::ios::in | std::ios::out | std::ios::binary);
+    fs.seekg(-4, std::ios::end);
+    char c = fs.get();
+    fs.seekp(-4, std::ios::end);
+    fs.put(static_cast<char>(c ^ 0x80));
+    fs.close();
+
+    HuffmanFile corrupted(path);
+    try {
+        HuffmanDecoder hd(corrupted);
+        FAIL() << "Expected checksum mismatch";
+    } catch (std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "Checksum mismatch in block 0");
+    }
+}
+
+// Truncated files are rejected before allocation.
+TEST(HuffmanFileTest, RejectTruncatedFile) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder("ABANANAABANDANA").result().write(ss);
+    std::string data = ss.str();
+
+    for (std::size_t len : {std::size_t(0), std::size_t(3), std::size_t(10), data.size() - 1}) {
+        std::istringstream iss(data.substr(0, len), std::ios::binary);
+        EXPECT_THROW(HuffmanFile hf(iss), std::runtime_error) << "length " << len;
+    }
+}
+
+// Header sizes inconsistent with a full binary tree are rejected.
+TEST(HuffmanFileTest, RejectBadTreeSize) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder("ABANANAABANDANA").result().write(ss);
+    std::string data = ss.str();
+
+    // Claim a huge leaf count.
+    uint32_t leafCount = 0xFFFFFFFF;
+    data.replace(8, sizeof(leafCount), reinterpret_cast<const char*>(&leafCount), sizeof(leafCount));
+    std::istringstream iss(data, std::ios::binary);
+    EXPECT_THROW(HuffmanFile hf(iss), std::runtime_error);
+}
+
+// Malformed tree bits are rejected.
+TEST(HuffmanDecoderTest, RejectMalformedTree) {
+    HuffmanFile hf({{1, 1, 1, 1, 0, 0, 0}, {'D', 'B', 'N', 'A'}, {1, 0}});
+    EXPECT_THROW(HuffmanDecoder hd(hf), std::runtime_error);
+}
+
+// A character on two leaves would leave part of the decode table empty,
+// and the table kernel would never advance.
+TEST(HuffmanDecoderTest, RejectDuplicateLeafInFile) {
+    // "HUFF", tree 11000, leaves "aab", content 01.
+    const std::string data("HUFF\x05\0\0\0\x03\0\0\0\x02\0\0\0\xC0"
+                           "aab\x40",
+                           21);
+    std::istringstream iss(data, std::ios::binary);
+    HuffmanFile hf(iss);
+    EXPECT_THROW(HuffmanDecoder hd(hf), std::runtime_error);
+    std::istringstream stream(data, std::ios::binary);
+    std::ostringstream out;
+    EXPECT_THROW(HuffmanDecoder hd(stream, out), std::runtime_error);
+}
+
+// Trees built directly from leaves are checked too.
+TEST(HuffmanDecoderTest, RejectDuplicateLeaf) {
+    HuffmanFile encoded = HuffmanEncoder("ABANANAABANDANA").result();
+    std::deque<char> leaves = encoded.getLeaves();
+    leaves[1] = leaves[0];
+    HuffmanFile hf(encoded.getTreeBits(), leaves, encoded.getContent());
+    EXPECT_THROW(HuffmanDecoder hd(hf), std::runtime_error);
+}
+
+// Content ending mid-code is rejected.
+TEST(HuffmanDecoderTest, RejectTruncatedCode) {
+    HuffmanFile hf({{1, 1, 1, 0, 0, 0, 0}, {'D', 'B', 'N', 'A'}, {1, 0, 0}});
+    EXPECT_THROW(HuffmanDecoder hd(hf), std::runtime_error);
+}
+
+// Helper function to build a string with Fibonacci character frequencies,
+// which gives a maximally deep tree.
+std::string fibonacciString(int chars) {
+    std::string content;
+    std::size_t a = 1, b = 1;
+    for (int i = 0; i < chars; ++i) {
+        content.append(a, static_cast<char>('a' + i));
+        std::size_t next = a + b;
+        a = b;
+        b = next;
+    }
+    return content;
+}
+
+// All decode modes agree, for both table-sized and over-long codes.
+TEST(HuffmanDecoderTest, DecodeModesAgree) {
+    for (int chars : {4, 9, 12, 20}) {
+        std::string content = fibonacciString(chars);
+        HuffmanFile file = HuffmanEncoder(content, 100).result();
+        for (auto mode : {HuffmanDecoder::Mode::Auto, HuffmanDecoder::Mode::Tree}) {
+            HuffmanDecoder decoder(file, mode);
+            EXPECT_EQ(decoder.result(), content) << chars << " chars, mode " << static_cast<int>(mode);
+        }
+    }
+}
+
+// Helper function to build a long string with skewed character frequencies.
+std::string skewedString(std::size_t size, int alphabet) {
+    std::mt19937 rng(7);
+    std::string content(size, 0);
+    for (char& c : content) {
+        // Minimum of two draws favours low characters.
+        c = static_cast<char>('!' + std::min(rng() % alphabet, rng() % alphabet));
+    }
+    return content;
+}
+
+// Encoder records where each block starts.
+TEST(HuffmanEncoderTest, SyncOffsets) {
+    HuffmanFile hf = HuffmanEncoder("ABANANAABANDANA", 4).result();
+    // Codes: A=1, B=001, D=000, N=01.
+    EXPECT_EQ(hf.getSyncOffsets(), (std::vector<uint32_t>{0, 7, 12, 21}));
+
+    HuffmanFile noSync = HuffmanEncoder("ABANANAABANDANA", 4, false).result();
+    EXPECT_TRUE(noSync.getSyncOffsets().empty());
+}
+
+// Parallel decoding from sync points and by speculation agrees with serial decoding.
+TEST(HuffmanDecoderTest, ParallelDecode) {
+    for (int alphabet : {16, 90}) {
+        std::string content = skewedString(300000, alphabet);
+        for (bool syncPoints : {true, false}) {
+            HuffmanFile file = HuffmanEncoder(content, 4096, syncPoints).result();
+            for (auto mode : {HuffmanDecoder::Mode::Auto, HuffmanDecoder::Mode::Tree}) {
+                for (unsigned threads : {2u, 4u, 7u}) {
+                    HuffmanDecoder decoder(file, mode, threads);
+                    EXPECT_EQ(decoder.result(), content)
+                        << "alphabet " << alphabet << ", sync " << syncPoints << ", threads " << threads;
+                }
+            }
+        }
+    }
+}
+
+// Legacy files without checksums decode in parallel by speculation.
+TEST(HuffmanDecoderTest, ParallelDecodeLegacy) {
+    std::string content = skewedString(300000, 40);
+    HuffmanFile encoded = HuffmanEncoder(content).result();
+    HuffmanFile legacy(encoded.getTreeBits(), encoded.getLeaves(), encoded.getContent());
+    HuffmanDecoder decoder(legacy, HuffmanDecoder::Mode::Auto, 4);
+    EXPECT_EQ(decoder.result(), content);
+}
+
+// Sync tables that do not start at bit 0 or do not increase are rejected.
+TEST(HuffmanFileTest, RejectBadSyncTable) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder("ABANANAABANDANA", 4).result().write(ss);
+    std::string data = ss.str();
+
+    // Magic, 3 sizes, 3 checksum fields, 4 block checksums, then 4 sync offsets.
+    const std::size_t syncTable = 4 + 6 * 4 + 4 * 4;
+    uint32_t offset = 13;
+    data.replace(syncTable + 4, sizeof(offset), reinterpret_cast<const char*>(&offset), sizeof(offset));
+    std::istringstream iss(data, std::ios::binary);
+    EXPECT_THROW(HuffmanFile hf(iss), std::runtime_error);
+}
+
+// Stream encoding decodes back with both decoders.
+TEST(HuffmanStreamTest, RoundTrip) {
+    std::string content = skewedString(300000, 64);
+    std::istringstream in(content, std::ios::binary);
+    std::stringstream encoded(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder encoder(in, encoded);
+    EXPECT_EQ(encoder.stats().blockSize, HuffmanFile::DEFAULT_BLOCK_SIZE);
+
+    encoded.seekg(0);
+    EXPECT_EQ(HuffmanDecoder(HuffmanFile(encoded)).result(), content);
+    for (unsigned threads : {1u, 4u}) {
+        HuffmanOptions options;
+        options.threads = threads;
+        encoded.clear();
+        encoded.seekg(0);
+        std::ostringstream decoded(std::ios::binary);
+        HuffmanDecoder decoder(encoded, decoded, options);
+        EXPECT_EQ(decoded.str(), content) << "threads " << threads;
+        EXPECT_EQ(decoder.stats().threads, threads);
+    }
+}
+
+// Files from the in-memory encoder, with or without sync points and checksums, stream decode.
+TEST(HuffmanStreamTest, DecodeInMemoryFiles) {
+    std::string content = skewedString(300000, 90);
+    HuffmanFile encoded = HuffmanEncoder(content, 4096, false).result();
+    for (const HuffmanFile& file : {HuffmanEncoder(content, 4096).result(), encoded,
+                                    HuffmanFile(encoded.getTreeBits(), encoded.getLeaves(), encoded.getContent())}) {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        file.write(ss);
+        for (unsigned threads : {1u, 3u}) {
+            HuffmanOptions options;
+            options.threads = threads;
+            ss.clear();
+            ss.seekg(0);
+            std::ostringstream decoded(std::ios::binary);
+            HuffmanDecoder decoder(ss, decoded, options);
+            EXPECT_EQ(decoded.str(), content);
+        }
+    }
+}
+
+// Under a cap, block size and buffers shrink and the reported peak stays within it.
+TEST(HuffmanStreamTest, MemoryCap) {
+    std::string content = skewedString(1 << 20, 40);
+    HuffmanOptions options;
+    options.maxMemory = 256 * 1024;
+    options.threads = 4;
+
+    std::istringstream in(content, std::ios::binary);
+    std::stringstream encoded(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder encoder(in, encoded, options);
+    EXPECT_LE(encoder.stats().peakMemory, options.maxMemory);
+    EXPECT_EQ(encoder.stats().blockSize, options.maxMemory / 16);
+    EXPECT_LT(encoder.stats().bufferSize, HuffmanMemory::DEFAULT_BUFFER_SIZE);
+
+    encoded.seekg(0);
+    std::ostringstream decoded(std::ios::binary);
+    HuffmanDecoder decoder(encoded, decoded, options);
+    EXPECT_EQ(decoded.str(), content);
+    EXPECT_LE(decoder.stats().peakMemory, options.maxMemory);
+    EXPECT_GE(decoder.stats().threads, 2u);
+}
+
+// In-memory constructors report their buffers too.
+TEST(HuffmanStreamTest, InMemoryStats) {
+    std::string content = skewedString(100000, 40);
+    HuffmanEncoder encoder(content);
+    HuffmanFile file = encoder.result();
+    EXPECT_GE(encoder.stats().bufferSize, file.size() / 2);
+    EXPECT_GT(encoder.stats().peakMemory, encoder.stats().bufferSize);
+    EXPECT_EQ(encoder.stats().threads, 1u);
+
+    HuffmanDecoder decoder(file);
+    EXPECT_GT(decoder.stats().bufferSize, 0u);
+    EXPECT_GT(decoder.stats().peakMemory, content.size());
+}
+
+// Speculative decoding counts each chunk's output while it waits to be verified,
+// on top of the content and the output it is appended to.
+TEST(HuffmanStreamTest, SpeculativeStats) {
+    std::string content = skewedString(300000, 40);
+    HuffmanFile encoded = HuffmanEncoder(content).result();
+    HuffmanFile legacy(encoded.getTreeBits(), encoded.getLeaves(), encoded.getContent());
+    HuffmanDecoder decoder(legacy, HuffmanDecoder::Mode::Auto, 4);
+    EXPECT_EQ(decoder.stats().threads, 4u);
+    EXPECT_GE(decoder.stats().peakMemory, decoder.stats().bufferSize + content.size() * 5 / 4);
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    legacy.write(ss);
+    HuffmanOptions options;
+    options.threads = 4;
+    std::ostringstream decoded(std::ios::binary);
+    HuffmanDecoder stream(ss, decoded, options);
+    EXPECT_EQ(decoded.str(), content);
+    EXPECT_EQ(stream.stats().bufferSize, (legacy.getContent().size() + 7) / 8 + 8);
+    EXPECT_GE(stream.stats().peakMemory, stream.stats().bufferSize + content.size() * 5 / 4);
+}
+
+// Block tables over the cap are rejected before they are allocated.
+TEST(HuffmanStreamTest, RejectTablesOverCap) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder(skewedString(300000, 40), 4).result().write(ss);
+    HuffmanOptions options;
+    options.maxMemory = 256 * 1024;
+    std::ostringstream decoded(std::ios::binary);
+    try {
+        HuffmanDecoder(ss, decoded, options);
+        FAIL() << "expected a budget error";
+    } catch (std::runtime_error& e) {
+        EXPECT_NE(std::string(e.what()).find("Memory budget exceeded"), std::string::npos) << e.what();
+    }
+    EXPECT_TRUE(decoded.str().empty());
+}
+
+// A cap too small for the tree and buffers is reported, not exceeded.
+TEST(HuffmanStreamTest, RejectTinyCap) {
+    std::string content = skewedString(10000, 40);
+    HuffmanOptions options;
+    options.maxMemory = 8 * 1024;
+    std::istringstream in(content, std::ios::binary);
+    std::stringstream encoded(std::ios::in | std::ios::out | std::ios::binary);
+    EXPECT_THROW(HuffmanEncoder(in, encoded, options), std::runtime_error);
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder(content).result().write(ss);
+    std::ostringstream decoded(std::ios::binary);
+    EXPECT_THROW(HuffmanDecoder(ss, decoded, options), std::runtime_error);
+}
+
+// Sync tables are checked before batch buffers are sized, so a header declaring
+// huge blocks over long codes is rejected without allocating for them.
+TEST(HuffmanStreamTest, RejectOversizedBlocks) {
+    // Chain tree: every leaf one level deeper, so the longest code is 255 bits.
+    const uint32_t contentBits = 32 << 20;
+    std::vector<uint32_t> words{511, 256, contentBits, contentBits - 1, 2, 0, 0, 0, 0, 1};
+    std::string data("HUF3");
+    for (uint32_t word : words) {
+        for (int i = 0; i < 4; ++i) {
+            data += static_cast<char>(word >> (8 * i));
+        }
+    }
+    data += std::string(63, '\xAA') + '\xA8';
+    for (int c = 0; c < 256; ++c) {
+        data += static_cast<char>(c);
+    }
+    data += std::string(contentBits / 8, '\0');
+
+    HuffmanOptions options;
+    options.threads = 2;
+    std::istringstream in(data, std::ios::binary);
+    std::ostringstream decoded(std::ios::binary);
+    try {
+        HuffmanDecoder decoder(in, decoded, options);
+        FAIL() << "decoded a bad sync table";
+    } catch (const std::runtime_error& e) {
+        EXPECT_EQ(std::string(e.what()), "Sync point mismatch in block 0");
+    }
+}
+
+#ifdef HUFF_PATH
+// Run huff with args, discarding its output. Returns the exit status.
+int runHuff(const std::string& args) {
+    return std::system(("\"" HUFF_PATH "\" " + args + " > /dev/null 2>&1").c_str());
+}
+
+std::string readAll(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    return oss.str();
+}
+
+void writeAll(const std::string& path, const std::string& data) {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(data.data(), data.size());
+}
+
+// Round trip through the CLI, with and without a cap.
+TEST(HuffCliTest, RoundTrip) {
+    const std::string src = testing::TempDir() + "cli_src.txt";
+    const std::string packed = testing::TempDir() + "cli_src.huff";
+    const std::string dst = testing::TempDir() + "cli_dst.txt";
+    std::string content = skewedString(300000, 40);
+    writeAll(src, content);
+
+    for (const std::string options : {"", " --max-memory 256K"}) {
+        EXPECT_EQ(runHuff("-c \"" + src + "\" \"" + packed + "\"" + options), 0);
+        EXPECT_EQ(runHuff("-x \"" + packed + "\" \"" + dst + "\"" + options + " -j 2"), 0);
+        EXPECT_EQ(readAll(dst), content) << options;
+    }
+}
+
+// A corrupt archive fails without touching an existing target.
+TEST(HuffCliTest, CorruptArchiveLeavesTargetAlone) {
+    const std::string src = testing::TempDir() + "cli_corrupt.huff";
+    const std::string dst = testing::TempDir() + "cli_corrupt.txt";
+    std::string content = skewedString(2000000, 40);
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    HuffmanEncoder(content).result().write(ss);
+    std::string data = ss.str();
+    data[data.size() / 2] ^= 0x10;
+    writeAll(src, data);
+
+    for (const std::string options : {"", " -j 4"}) {
+        writeAll(dst, "previous");
+        EXPECT_NE(runHuff("-x \"" + src + "\" \"" + dst + "\"" + options), 0);
+        EXPECT_EQ(readAll(dst), "previous") << options;
+        EXPECT_FALSE(std::ifstream(dst + ".huff-tmp").is_open());
+    }
+}
+
+// A failed compress leaves no target.
+TEST(HuffCliTest, FailedCompressLeavesNoTarget) {
+    const std::string src = testing::TempDir() + "cli_sole.txt";
+    const std::string dst = testing::TempDir() + "cli_sole.huff";
+    writeAll(src, "aaaa");
+    std::remove(dst.c_str());
+    EXPECT_NE(runHuff("-c \"" + src + "\" \"" + dst + "\""), 0);
+    EXPECT_FALSE(std::ifstream(dst).is_open());
+}
+
+// Thread counts and sizes must be plain positive numbers.
+TEST(HuffCliTest, RejectBadNumbers) {
+    const std::string src = testing::TempDir() + "cli_args.txt";
+    const std::string dst = testing::TempDir() + "cli_args.huff";
+    writeAll(src, "ABANANAABANDANA");
+    ASSERT_EQ(runHuff("-c \"" + src + "\" \"" + dst + "\""), 0);
+    for (const std::string options : {"-j 4x", "-j -1", "-j 0", "--max-memory -1", "--max-memory 64Q"}) {
+        EXPECT_NE(runHuff("-x \"" + dst + "\" \"" + src + ".out\" " + options), 0) << options;
+    }
+}
+#endif